@@ -0,0 +1,133 @@
+//---------------------------------------------------------------------------
+#include <mutex>
+#include "ColorClassTable.h"
+#include "SitePolicies.h"
+
+//---------------------------------------------------------------------------
+
+// Everything a table's contents depend on
+struct TableKey {
+    int programType;
+    int borderColor, borderLimit;
+    bool borderExact;
+    bool piecesCalibrated;
+    int whiteAbove, blackBelow, whiteThreshold, blackThreshold;
+    bool squaresCalibrated;
+    int lightSquare, darkSquare;
+
+    explicit TableKey(const SitePolicyParams &params)
+        : programType(params.programType), borderColor(params.borderColor),
+          borderLimit(params.borderLimit), borderExact(params.borderExact),
+          piecesCalibrated(params.piecesCalibrated), whiteAbove(params.whiteAbove),
+          blackBelow(params.blackBelow), whiteThreshold(params.whiteThreshold),
+          blackThreshold(params.blackThreshold), squaresCalibrated(params.squaresCalibrated),
+          lightSquare(params.lightSquare), darkSquare(params.darkSquare) {}
+
+    bool operator==(const TableKey &k) const {
+        return programType == k.programType && borderColor == k.borderColor &&
+               borderLimit == k.borderLimit && borderExact == k.borderExact &&
+               piecesCalibrated == k.piecesCalibrated && whiteAbove == k.whiteAbove &&
+               blackBelow == k.blackBelow && whiteThreshold == k.whiteThreshold &&
+               blackThreshold == k.blackThreshold && squaresCalibrated == k.squaresCalibrated &&
+               lightSquare == k.lightSquare && darkSquare == k.darkSquare;
+    }
+};
+
+struct SharedTable {
+    TableKey key;
+    std::weak_ptr<const TColorClassTable> table;
+
+    SharedTable(const TableKey &k, const std::shared_ptr<const TColorClassTable> &t) : key(k), table(t) {}
+};
+
+static std::mutex TablesLock;
+static std::vector<SharedTable> Tables;
+
+// Fills a table with the direct predicates of whatever policy the site uses
+struct TableBuilder {
+    TColorClassTable *table;
+    const SitePolicyParams *params;
+
+    template<class Policy> void UsePolicy() {
+        typedef typename DirectPolicy<Policy>::Type Direct;
+        table->Fill(Direct(*params), *params);
+    }
+};
+
+static bool NearColor(int pixel, int color, int limit)
+{
+  int d0 = (pixel & 255) - (color & 255);
+  int d1 = ((pixel>>8) & 255) - ((color>>8) & 255);
+  int d2 = ((pixel>>16) & 255) - ((color>>16) & 255);
+  return d0*d0 + d1*d1 + d2*d2 <= limit;
+}
+
+template<class Policy>
+void TColorClassTable::Fill(const Policy &policy, const SitePolicyParams &params)
+{
+  Table.resize(1<<24);
+  bool squares = params.squaresCalibrated;
+  int light = params.lightSquare;
+  int dark = params.darkSquare;
+  int limit = square_color_tolerance*square_color_tolerance;
+  for (int color=0; color<(1<<24); color++) {
+    unsigned char classes = 0;
+    if (policy.Border(color))
+      classes |= ClassBorder;
+    if (policy.White(color))
+      classes |= ClassWhite;
+    if (policy.Black(color))
+      classes |= ClassBlack;
+    if (policy.Mark(color))
+      classes |= ClassMark;
+    if (squares && NearColor(color, light, limit))
+      classes |= ClassLightSquare;
+    if (squares && NearColor(color, dark, limit))
+      classes |= ClassDarkSquare;
+    Table[color] = classes;
+  }
+}
+
+// The shared table for key, or none; TablesLock must be held
+static std::shared_ptr<const TColorClassTable> FindTable(const TableKey &key)
+{
+  for (size_t i=0; i<Tables.size(); ) {
+    std::shared_ptr<const TColorClassTable> table = Tables[i].table.lock();
+    if (!table) {
+      // Nobody uses it any more
+      Tables.erase(Tables.begin() + i);
+      continue;
+    }
+    if (Tables[i].key == key)
+      return table;
+    i++;
+  }
+  return std::shared_ptr<const TColorClassTable>();
+}
+
+std::shared_ptr<const TColorClassTable> TColorClassTable::Get(const SitePolicyParams &params)
+{
+  TableKey key(params);
+  {
+    std::lock_guard<std::mutex> lock(TablesLock);
+    std::shared_ptr<const TColorClassTable> shared = FindTable(key);
+    if (shared)
+      return shared;
+  }
+
+  // Filling 16M entries takes a while, so it runs unlocked: recognizers
+  // of other sites go on meanwhile. One that built the same table first
+  // wins and this one is dropped
+  std::shared_ptr<TColorClassTable> table(new TColorClassTable());
+  TableBuilder builder;
+  builder.table = table.get();
+  builder.params = &params;
+  SelectSitePolicy(params.programType, builder);
+
+  std::lock_guard<std::mutex> lock(TablesLock);
+  std::shared_ptr<const TColorClassTable> shared = FindTable(key);
+  if (shared)
+    return shared;
+  Tables.push_back(SharedTable(key, table));
+  return table;
+}
@@ -0,0 +1,40 @@
+//---------------------------------------------------------------------------
+
+#ifndef ColorClassTableH
+#define ColorClassTableH
+
+#include <memory>
+#include <vector>
+//---------------------------------------------------------------------------
+// Colour class lookup table: one byte of class bits for every 24-bit
+// screen colour (0x00RRGGBB), so classifying a pixel is a single load.
+// Tables are immutable once built and shared between everyone using the
+// same site and configuration, including recognizers on other threads.
+//---------------------------------------------------------------------------
+
+const unsigned char ClassBorder = 1;
+const unsigned char ClassWhite = 2;          // White piece
+const unsigned char ClassBlack = 4;          // Black piece
+const unsigned char ClassMark = 8;           // Last move / selection mark
+const unsigned char ClassLightSquare = 16;   // Near the calibrated light square
+const unsigned char ClassDarkSquare = 32;    // Near the calibrated dark square
+
+// RGB distance from a calibrated square colour still counted as that square
+const int square_color_tolerance = 24;
+
+struct SitePolicyParams;
+
+class TColorClassTable {
+  public:
+    unsigned char Classes(int color) const { return Table[color & 0xFFFFFF]; }
+    const unsigned char *Data() const { return &Table[0]; }
+    // Table for a site's policy settings; built on first request and
+    // shared for as long as anybody holds it
+    static std::shared_ptr<const TColorClassTable> Get(const SitePolicyParams &params);
+  private:
+    std::vector<unsigned char> Table;
+    template<class Policy> void Fill(const Policy &policy, const SitePolicyParams &params);
+    friend struct TableBuilder;
+};
+
+#endif
@@ -0,0 +1,442 @@
+//---------------------------------------------------------------------------
+// Row kernels declared in ColorUtils.h: scalar reference versions plus
+// SSE2 and AVX2 versions chosen at run time. Every version computes the
+// same integers, so results never depend on the CPU.
+//---------------------------------------------------------------------------
+#include <atomic>
+#include "ColorUtils.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+// (s * 21846) >> 16 == s / 3 for every channel sum s in 0..765
+const int div3_mul = 21846;
+
+//---------------------------------------------------------------------------
+// Scalar
+
+static void DistanceScalar(const int* pixels, int count, int target, int* distance2)
+{
+  int t0 = target & 255, t1 = (target>>8) & 255, t2 = (target>>16) & 255;
+  for (int i=0; i<count; i++) {
+    int v = pixels[i];
+    int d0 = (v & 255) - t0;
+    int d1 = ((v>>8) & 255) - t1;
+    int d2 = ((v>>16) & 255) - t2;
+    distance2[i] = d0*d0 + d1*d1 + d2*d2;
+  }
+}
+
+static void BrightnessScalar(const int* pixels, int count, unsigned char* brightness)
+{
+  for (int i=0; i<count; i++) {
+    int v = pixels[i];
+    brightness[i] = (unsigned char)(((v & 255) + ((v>>8) & 255) + ((v>>16) & 255)) / 3);
+  }
+}
+
+static void ThresholdScalar(const int* values, int count, int limit, unsigned char* mask)
+{
+  for (int i=0; i<count; i++)
+    mask[i] = values[i] <= limit;
+}
+
+static void PieceMaskScalar(const int* pixels, int count, int whiteAbove, int blackBelow,
+                            unsigned char* mask)
+{
+  for (int i=0; i<count; i++) {
+    int v = pixels[i];
+    int c0 = v & 255, c1 = (v>>8) & 255, c2 = (v>>16) & 255;
+    int mn = c0 < c1 ? c0 : c1;
+    int mx = c0 > c1 ? c0 : c1;
+    mn = mn < c2 ? mn : c2;
+    mx = mx > c2 ? mx : c2;
+    mask[i] = (mn > whiteAbove ? PIECE_MASK_WHITE : 0) | (mx < blackBelow ? PIECE_MASK_BLACK : 0);
+  }
+}
+
+static void UnpackScalar(const int* pixels, int count,
+                         unsigned char* c0, unsigned char* c1, unsigned char* c2)
+{
+  for (int i=0; i<count; i++) {
+    int v = pixels[i];
+    c0[i] = (unsigned char)(v & 255);
+    c1[i] = (unsigned char)((v>>8) & 255);
+    c2[i] = (unsigned char)((v>>16) & 255);
+  }
+}
+
+#ifdef KERNELS_X86
+//---------------------------------------------------------------------------
+// SSE2: 4 pixels per vector, 32-bit lanes holding values below 2^16 so
+// the 16-bit multiply-add and min/max instructions apply
+
+// Four vectors of 32-bit lanes (each 0..255) to 16 bytes, in order
+TARGET_SSE2 static inline __m128i PackBytesSSE2(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+  return _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+}
+
+TARGET_SSE2 static void DistanceSSE2(const int* pixels, int count, int target, int* distance2)
+{
+  const __m128i low8 = _mm_set1_epi32(255);
+  const __m128i low16 = _mm_set1_epi32(0xFFFF);
+  const __m128i t0 = _mm_set1_epi32(target & 255);
+  const __m128i t1 = _mm_set1_epi32((target>>8) & 255);
+  const __m128i t2 = _mm_set1_epi32((target>>16) & 255);
+  int i = 0;
+  for (; i+4<=count; i+=4) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(pixels + i));
+    // Differences as signed 16-bit values in the low half of each lane;
+    // madd squares them and adds the zero high half
+    __m128i d0 = _mm_and_si128(_mm_sub_epi32(_mm_and_si128(v, low8), t0), low16);
+    __m128i d1 = _mm_and_si128(_mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(v, 8), low8), t1), low16);
+    __m128i d2 = _mm_and_si128(_mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(v, 16), low8), t2), low16);
+    __m128i sum = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(d0, d0), _mm_madd_epi16(d1, d1)),
+                                _mm_madd_epi16(d2, d2));
+    _mm_storeu_si128((__m128i*)(distance2 + i), sum);
+  }
+  DistanceScalar(pixels + i, count - i, target, distance2 + i);
+}
+
+TARGET_SSE2 static inline __m128i BrightnessLanesSSE2(__m128i v)
+{
+  const __m128i low8 = _mm_set1_epi32(255);
+  const __m128i div3 = _mm_set1_epi32(div3_mul);
+  __m128i sum = _mm_add_epi32(_mm_add_epi32(_mm_and_si128(v, low8),
+                                            _mm_and_si128(_mm_srli_epi32(v, 8), low8)),
+                              _mm_and_si128(_mm_srli_epi32(v, 16), low8));
+  return _mm_srli_epi32(_mm_madd_epi16(sum, div3), 16);
+}
+
+TARGET_SSE2 static void BrightnessSSE2(const int* pixels, int count, unsigned char* brightness)
+{
+  int i = 0;
+  for (; i+16<=count; i+=16) {
+    const __m128i* p = (const __m128i*)(pixels + i);
+    __m128i b = PackBytesSSE2(BrightnessLanesSSE2(_mm_loadu_si128(p)),
+                              BrightnessLanesSSE2(_mm_loadu_si128(p + 1)),
+                              BrightnessLanesSSE2(_mm_loadu_si128(p + 2)),
+                              BrightnessLanesSSE2(_mm_loadu_si128(p + 3)));
+    _mm_storeu_si128((__m128i*)(brightness + i), b);
+  }
+  BrightnessScalar(pixels + i, count - i, brightness + i);
+}
+
+TARGET_SSE2 static void ThresholdSSE2(const int* values, int count, int limit, unsigned char* mask)
+{
+  const __m128i lim = _mm_set1_epi32(limit);
+  const __m128i one = _mm_set1_epi8(1);
+  int i = 0;
+  for (; i+16<=count; i+=16) {
+    const __m128i* p = (const __m128i*)(values + i);
+    __m128i a = _mm_cmpgt_epi32(_mm_loadu_si128(p), lim);
+    __m128i b = _mm_cmpgt_epi32(_mm_loadu_si128(p + 1), lim);
+    __m128i c = _mm_cmpgt_epi32(_mm_loadu_si128(p + 2), lim);
+    __m128i d = _mm_cmpgt_epi32(_mm_loadu_si128(p + 3), lim);
+    __m128i above = _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+    _mm_storeu_si128((__m128i*)(mask + i), _mm_andnot_si128(above, one));
+  }
+  ThresholdScalar(values + i, count - i, limit, mask + i);
+}
+
+TARGET_SSE2 static inline __m128i PieceLanesSSE2(__m128i v, __m128i above, __m128i below)
+{
+  const __m128i low8 = _mm_set1_epi32(255);
+  __m128i c0 = _mm_and_si128(v, low8);
+  __m128i c1 = _mm_and_si128(_mm_srli_epi32(v, 8), low8);
+  __m128i c2 = _mm_and_si128(_mm_srli_epi32(v, 16), low8);
+  __m128i mn = _mm_min_epi16(_mm_min_epi16(c0, c1), c2);
+  __m128i mx = _mm_max_epi16(_mm_max_epi16(c0, c1), c2);
+  __m128i white = _mm_and_si128(_mm_cmpgt_epi32(mn, above), _mm_set1_epi32(PIECE_MASK_WHITE));
+  __m128i black = _mm_and_si128(_mm_cmpgt_epi32(below, mx), _mm_set1_epi32(PIECE_MASK_BLACK));
+  return _mm_or_si128(white, black);
+}
+
+TARGET_SSE2 static void PieceMaskSSE2(const int* pixels, int count, int whiteAbove, int blackBelow,
+                                      unsigned char* mask)
+{
+  const __m128i above = _mm_set1_epi32(whiteAbove);
+  const __m128i below = _mm_set1_epi32(blackBelow);
+  int i = 0;
+  for (; i+16<=count; i+=16) {
+    const __m128i* p = (const __m128i*)(pixels + i);
+    __m128i m = PackBytesSSE2(PieceLanesSSE2(_mm_loadu_si128(p), above, below),
+                              PieceLanesSSE2(_mm_loadu_si128(p + 1), above, below),
+                              PieceLanesSSE2(_mm_loadu_si128(p + 2), above, below),
+                              PieceLanesSSE2(_mm_loadu_si128(p + 3), above, below));
+    _mm_storeu_si128((__m128i*)(mask + i), m);
+  }
+  PieceMaskScalar(pixels + i, count - i, whiteAbove, blackBelow, mask + i);
+}
+
+TARGET_SSE2 static void UnpackSSE2(const int* pixels, int count,
+                                   unsigned char* c0, unsigned char* c1, unsigned char* c2)
+{
+  const __m128i low8 = _mm_set1_epi32(255);
+  int i = 0;
+  for (; i+16<=count; i+=16) {
+    const __m128i* p = (const __m128i*)(pixels + i);
+    __m128i a = _mm_loadu_si128(p);
+    __m128i b = _mm_loadu_si128(p + 1);
+    __m128i c = _mm_loadu_si128(p + 2);
+    __m128i d = _mm_loadu_si128(p + 3);
+    _mm_storeu_si128((__m128i*)(c0 + i),
+        PackBytesSSE2(_mm_and_si128(a, low8), _mm_and_si128(b, low8),
+                      _mm_and_si128(c, low8), _mm_and_si128(d, low8)));
+    _mm_storeu_si128((__m128i*)(c1 + i),
+        PackBytesSSE2(_mm_and_si128(_mm_srli_epi32(a, 8), low8), _mm_and_si128(_mm_srli_epi32(b, 8), low8),
+                      _mm_and_si128(_mm_srli_epi32(c, 8), low8), _mm_and_si128(_mm_srli_epi32(d, 8), low8)));
+    _mm_storeu_si128((__m128i*)(c2 + i),
+        PackBytesSSE2(_mm_and_si128(_mm_srli_epi32(a, 16), low8), _mm_and_si128(_mm_srli_epi32(b, 16), low8),
+                      _mm_and_si128(_mm_srli_epi32(c, 16), low8), _mm_and_si128(_mm_srli_epi32(d, 16), low8)));
+  }
+  UnpackScalar(pixels + i, count - i, c0 + i, c1 + i, c2 + i);
+}
+
+//---------------------------------------------------------------------------
+// AVX2: the same arithmetic on 8 pixels per vector
+
+// Four vectors of 32-bit lanes (each 0..255) to 32 bytes, in order. The
+// packs work within 128-bit halves, so the dwords are put back in order.
+TARGET_AVX2 static inline __m256i PackBytesAVX2(__m256i a, __m256i b, __m256i c, __m256i d)
+{
+  __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+  return _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+TARGET_AVX2 static void DistanceAVX2(const int* pixels, int count, int target, int* distance2)
+{
+  const __m256i low8 = _mm256_set1_epi32(255);
+  const __m256i low16 = _mm256_set1_epi32(0xFFFF);
+  const __m256i t0 = _mm256_set1_epi32(target & 255);
+  const __m256i t1 = _mm256_set1_epi32((target>>8) & 255);
+  const __m256i t2 = _mm256_set1_epi32((target>>16) & 255);
+  int i = 0;
+  for (; i+8<=count; i+=8) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(pixels + i));
+    __m256i d0 = _mm256_and_si256(_mm256_sub_epi32(_mm256_and_si256(v, low8), t0), low16);
+    __m256i d1 = _mm256_and_si256(_mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(v, 8), low8), t1), low16);
+    __m256i d2 = _mm256_and_si256(_mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(v, 16), low8), t2), low16);
+    __m256i sum = _mm256_add_epi32(_mm256_add_epi32(_mm256_madd_epi16(d0, d0), _mm256_madd_epi16(d1, d1)),
+                                   _mm256_madd_epi16(d2, d2));
+    _mm256_storeu_si256((__m256i*)(distance2 + i), sum);
+  }
+  DistanceScalar(pixels + i, count - i, target, distance2 + i);
+}
+
+TARGET_AVX2 static inline __m256i BrightnessLanesAVX2(__m256i v)
+{
+  const __m256i low8 = _mm256_set1_epi32(255);
+  const __m256i div3 = _mm256_set1_epi32(div3_mul);
+  __m256i sum = _mm256_add_epi32(_mm256_add_epi32(_mm256_and_si256(v, low8),
+                                                  _mm256_and_si256(_mm256_srli_epi32(v, 8), low8)),
+                                 _mm256_and_si256(_mm256_srli_epi32(v, 16), low8));
+  return _mm256_srli_epi32(_mm256_madd_epi16(sum, div3), 16);
+}
+
+TARGET_AVX2 static void BrightnessAVX2(const int* pixels, int count, unsigned char* brightness)
+{
+  int i = 0;
+  for (; i+32<=count; i+=32) {
+    const __m256i* p = (const __m256i*)(pixels + i);
+    __m256i b = PackBytesAVX2(BrightnessLanesAVX2(_mm256_loadu_si256(p)),
+                              BrightnessLanesAVX2(_mm256_loadu_si256(p + 1)),
+                              BrightnessLanesAVX2(_mm256_loadu_si256(p + 2)),
+                              BrightnessLanesAVX2(_mm256_loadu_si256(p + 3)));
+    _mm256_storeu_si256((__m256i*)(brightness + i), b);
+  }
+  BrightnessScalar(pixels + i, count - i, brightness + i);
+}
+
+TARGET_AVX2 static void ThresholdAVX2(const int* values, int count, int limit, unsigned char* mask)
+{
+  const __m256i lim = _mm256_set1_epi32(limit);
+  const __m256i one = _mm256_set1_epi8(1);
+  int i = 0;
+  for (; i+32<=count; i+=32) {
+    const __m256i* p = (const __m256i*)(values + i);
+    __m256i a = _mm256_cmpgt_epi32(_mm256_loadu_si256(p), lim);
+    __m256i b = _mm256_cmpgt_epi32(_mm256_loadu_si256(p + 1), lim);
+    __m256i c = _mm256_cmpgt_epi32(_mm256_loadu_si256(p + 2), lim);
+    __m256i d = _mm256_cmpgt_epi32(_mm256_loadu_si256(p + 3), lim);
+    __m256i above = _mm256_packs_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+    above = _mm256_permutevar8x32_epi32(above, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+    _mm256_storeu_si256((__m256i*)(mask + i), _mm256_andnot_si256(above, one));
+  }
+  ThresholdScalar(values + i, count - i, limit, mask + i);
+}
+
+TARGET_AVX2 static inline __m256i PieceLanesAVX2(__m256i v, __m256i above, __m256i below)
+{
+  const __m256i low8 = _mm256_set1_epi32(255);
+  __m256i c0 = _mm256_and_si256(v, low8);
+  __m256i c1 = _mm256_and_si256(_mm256_srli_epi32(v, 8), low8);
+  __m256i c2 = _mm256_and_si256(_mm256_srli_epi32(v, 16), low8);
+  __m256i mn = _mm256_min_epi16(_mm256_min_epi16(c0, c1), c2);
+  __m256i mx = _mm256_max_epi16(_mm256_max_epi16(c0, c1), c2);
+  __m256i white = _mm256_and_si256(_mm256_cmpgt_epi32(mn, above), _mm256_set1_epi32(PIECE_MASK_WHITE));
+  __m256i black = _mm256_and_si256(_mm256_cmpgt_epi32(below, mx), _mm256_set1_epi32(PIECE_MASK_BLACK));
+  return _mm256_or_si256(white, black);
+}
+
+TARGET_AVX2 static void PieceMaskAVX2(const int* pixels, int count, int whiteAbove, int blackBelow,
+                                      unsigned char* mask)
+{
+  const __m256i above = _mm256_set1_epi32(whiteAbove);
+  const __m256i below = _mm256_set1_epi32(blackBelow);
+  int i = 0;
+  for (; i+32<=count; i+=32) {
+    const __m256i* p = (const __m256i*)(pixels + i);
+    __m256i m = PackBytesAVX2(PieceLanesAVX2(_mm256_loadu_si256(p), above, below),
+                              PieceLanesAVX2(_mm256_loadu_si256(p + 1), above, below),
+                              PieceLanesAVX2(_mm256_loadu_si256(p + 2), above, below),
+                              PieceLanesAVX2(_mm256_loadu_si256(p + 3), above, below));
+    _mm256_storeu_si256((__m256i*)(mask + i), m);
+  }
+  PieceMaskScalar(pixels + i, count - i, whiteAbove, blackBelow, mask + i);
+}
+
+TARGET_AVX2 static void UnpackAVX2(const int* pixels, int count,
+                                   unsigned char* c0, unsigned char* c1, unsigned char* c2)
+{
+  const __m256i low8 = _mm256_set1_epi32(255);
+  int i = 0;
+  for (; i+32<=count; i+=32) {
+    const __m256i* p = (const __m256i*)(pixels + i);
+    __m256i a = _mm256_loadu_si256(p);
+    __m256i b = _mm256_loadu_si256(p + 1);
+    __m256i c = _mm256_loadu_si256(p + 2);
+    __m256i d = _mm256_loadu_si256(p + 3);
+    _mm256_storeu_si256((__m256i*)(c0 + i),
+        PackBytesAVX2(_mm256_and_si256(a, low8), _mm256_and_si256(b, low8),
+                      _mm256_and_si256(c, low8), _mm256_and_si256(d, low8)));
+    _mm256_storeu_si256((__m256i*)(c1 + i),
+        PackBytesAVX2(_mm256_and_si256(_mm256_srli_epi32(a, 8), low8), _mm256_and_si256(_mm256_srli_epi32(b, 8), low8),
+                      _mm256_and_si256(_mm256_srli_epi32(c, 8), low8), _mm256_and_si256(_mm256_srli_epi32(d, 8), low8)));
+    _mm256_storeu_si256((__m256i*)(c2 + i),
+        PackBytesAVX2(_mm256_and_si256(_mm256_srli_epi32(a, 16), low8), _mm256_and_si256(_mm256_srli_epi32(b, 16), low8),
+                      _mm256_and_si256(_mm256_srli_epi32(c, 16), low8), _mm256_and_si256(_mm256_srli_epi32(d, 16), low8)));
+  }
+  UnpackScalar(pixels + i, count - i, c0 + i, c1 + i, c2 + i);
+}
+#endif
+
+//---------------------------------------------------------------------------
+// Dispatch
+
+static std::atomic<int> KernelLevel(-1);
+
+ColorKernelLevel DetectColorKernelLevel()
+{
+#if defined(KERNELS_X86) && defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  int max_leaf = info[0];
+  __cpuid(info, 1);
+  bool sse2 = (info[3] & (1<<26)) != 0;
+  bool osxsave = (info[2] & (1<<27)) != 0;
+  bool avx = (info[2] & (1<<28)) != 0;
+  if (max_leaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6) {
+    __cpuidex(info, 7, 0);
+    if (info[1] & (1<<5))
+      return KERNELS_AVX2;
+  }
+  return sse2 ? KERNELS_SSE2 : KERNELS_SCALAR;
+#elif defined(KERNELS_X86) && defined(__GNUC__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return KERNELS_AVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return KERNELS_SSE2;
+  return KERNELS_SCALAR;
+#else
+  return KERNELS_SCALAR;
+#endif
+}
+
+ColorKernelLevel GetColorKernelLevel()
+{
+  int level = KernelLevel.load(std::memory_order_relaxed);
+  if (level < 0) {
+    level = DetectColorKernelLevel();
+    KernelLevel.store(level, std::memory_order_relaxed);
+  }
+  return (ColorKernelLevel)level;
+}
+
+void SetColorKernelLevel(ColorKernelLevel level)
+{
+  ColorKernelLevel best = DetectColorKernelLevel();
+  KernelLevel.store(level < best ? level : best, std::memory_order_relaxed);
+}
+
+void ColorDistanceRow(const int* pixels, int count, int target, int* distance2)
+{
+  switch (GetColorKernelLevel()) {
+#ifdef KERNELS_X86
+    case KERNELS_AVX2: DistanceAVX2(pixels, count, target, distance2); return;
+    case KERNELS_SSE2: DistanceSSE2(pixels, count, target, distance2); return;
+#endif
+    default: DistanceScalar(pixels, count, target, distance2); return;
+  }
+}
+
+void BrightnessRow(const int* pixels, int count, unsigned char* brightness)
+{
+  switch (GetColorKernelLevel()) {
+#ifdef KERNELS_X86
+    case KERNELS_AVX2: BrightnessAVX2(pixels, count, brightness); return;
+    case KERNELS_SSE2: BrightnessSSE2(pixels, count, brightness); return;
+#endif
+    default: BrightnessScalar(pixels, count, brightness); return;
+  }
+}
+
+void ThresholdMaskRow(const int* values, int count, int limit, unsigned char* mask)
+{
+  switch (GetColorKernelLevel()) {
+#ifdef KERNELS_X86
+    case KERNELS_AVX2: ThresholdAVX2(values, count, limit, mask); return;
+    case KERNELS_SSE2: ThresholdSSE2(values, count, limit, mask); return;
+#endif
+    default: ThresholdScalar(values, count, limit, mask); return;
+  }
+}
+
+void PieceMaskRow(const int* pixels, int count, int whiteAbove, int blackBelow,
+                  unsigned char* mask)
+{
+  switch (GetColorKernelLevel()) {
+#ifdef KERNELS_X86
+    case KERNELS_AVX2: PieceMaskAVX2(pixels, count, whiteAbove, blackBelow, mask); return;
+    case KERNELS_SSE2: PieceMaskSSE2(pixels, count, whiteAbove, blackBelow, mask); return;
+#endif
+    default: PieceMaskScalar(pixels, count, whiteAbove, blackBelow, mask); return;
+  }
+}
+
+void UnpackRow(const int* pixels, int count,
+               unsigned char* c0, unsigned char* c1, unsigned char* c2)
+{
+  switch (GetColorKernelLevel()) {
+#ifdef KERNELS_X86
+    case KERNELS_AVX2: UnpackAVX2(pixels, count, c0, c1, c2); return;
+    case KERNELS_SSE2: UnpackSSE2(pixels, count, c0, c1, c2); return;
+#endif
+    default: UnpackScalar(pixels, count, c0, c1, c2); return;
+  }
+}
@@ -168,4 +168,44 @@ inline bool IsLight(int color, double brightnessThreshold = 0.7) {
     return GetBrightness(color) > brightnessThreshold;
 }
 
+//---------------------------------------------------------------------------
+// Batched row kernels on packed pixels. All arithmetic is fixed point;
+// SSE2 and AVX2 versions are picked at run time and give bit-identical
+// results to the scalar ones. Channels are numbered from the low byte.
+//---------------------------------------------------------------------------
+
+enum ColorKernelLevel {
+    KERNELS_SCALAR = 0,
+    KERNELS_SSE2 = 1,
+    KERNELS_AVX2 = 2
+};
+
+// Mask bits written by PieceMaskRow
+const unsigned char PIECE_MASK_WHITE = 1;
+const unsigned char PIECE_MASK_BLACK = 2;
+
+// Best level the CPU supports
+ColorKernelLevel DetectColorKernelLevel();
+// Level in use; lowering it is meant for testing and benchmarking
+ColorKernelLevel GetColorKernelLevel();
+void SetColorKernelLevel(ColorKernelLevel level);
+
+// Squared RGB distance of each pixel to target (alpha ignored)
+void ColorDistanceRow(const int* pixels, int count, int target, int* distance2);
+
+// Average brightness (c0+c1+c2)/3 of each pixel, rounded down
+void BrightnessRow(const int* pixels, int count, unsigned char* brightness);
+
+// mask[i] = 1 where values[i] <= limit, else 0
+void ThresholdMaskRow(const int* values, int count, int limit, unsigned char* mask);
+
+// PIECE_MASK_WHITE where every channel > whiteAbove, PIECE_MASK_BLACK
+// where every channel < blackBelow
+void PieceMaskRow(const int* pixels, int count, int whiteAbove, int blackBelow,
+                  unsigned char* mask);
+
+// Split pixels into planar channels
+void UnpackRow(const int* pixels, int count,
+               unsigned char* c0, unsigned char* c1, unsigned char* c2);
+
 #endif
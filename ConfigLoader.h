@@ -162,6 +162,7 @@ public:
         config.recognition.recognizeType = GetInt(section + ".recognition.type", 1);
         config.recognition.blackMax = GetInt(section + ".recognition.blackmax", 60);
         config.recognition.calcWhite = GetBool(section + ".recognition.calcwhite", false);
+        config.recognition.samples = GetInt(section + ".recognition.samples", 16);
         
         return true;
     }
@@ -2,8 +2,10 @@
 #ifndef DebugOverlayH
 #define DebugOverlayH
 
+#include <vector>
 #include "ColorUtils.h"
 #include "DetectionConfig.h"
+#include "SquareStats.h"
 
 //---------------------------------------------------------------------------
 // Debug visualization utilities for detection confidence and issues
@@ -59,38 +61,12 @@ inline ConfidenceLevel CalculateDetectionConfidence(int whitePixels, int blackPi
     return CONFIDENCE_NONE;
 }
 
-// Analyze a square and return detection result with confidence
-inline SquareDetection AnalyzeSquare(int* buffer, int startX, int startY, int squareSize, 
-                                      int bufferWidth, const SiteDetectionConfig& config,
-                                      bool (*isWhite)(int), bool (*isBlack)(int)) {
+// Turn the pixel counts and channel sums of a square into a result
+inline SquareDetection SummarizeSquare(int whiteCount, int blackCount, int totalCount,
+                                       long totalR, long totalG, long totalB,
+                                       const SiteDetectionConfig& config) {
     SquareDetection result;
     
-    int whiteCount = 0;
-    int blackCount = 0;
-    int totalCount = 0;
-    long totalR = 0, totalG = 0, totalB = 0;
-    
-    for (int y = 0; y < squareSize; y++) {
-        for (int x = 0; x < squareSize; x++) {
-            int px = startX + x;
-            int py = startY + y;
-            int idx = py * bufferWidth + px;
-            int pixel = buffer[idx];
-            
-            RGB rgb = UnpackColor(pixel);
-            totalR += rgb.r;
-            totalG += rgb.g;
-            totalB += rgb.b;
-            totalCount++;
-            
-            if (isWhite(pixel)) {
-                whiteCount++;
-            } else if (isBlack(pixel)) {
-                blackCount++;
-            }
-        }
-    }
-    
     if (totalCount > 0) {
         result.averageColor.r = (int)(totalR / totalCount);
         result.averageColor.g = (int)(totalG / totalCount);
@@ -131,6 +107,54 @@ inline SquareDetection AnalyzeSquare(int* buffer, int startX, int startY, int sq
     return result;
 }
 
+// Result of a square from its integral image totals; a pixel that is
+// both white and black counts as white
+inline SquareDetection SummarizeSquare(const SquareStats& stats, const SiteDetectionConfig& config) {
+    return SummarizeSquare(stats.white, stats.pieces - stats.white, stats.pixels,
+                           stats.sum[0], stats.sum[1], stats.sum[2], config);
+}
+
+// Piece classes from caller supplied tests; white wins where both say yes
+struct FunctionPieceClasses {
+    bool (*isWhite)(int);
+    bool (*isBlack)(int);
+    FunctionPieceClasses(bool (*white)(int), bool (*black)(int)) : isWhite(white), isBlack(black) {}
+    void PieceRow(const int* row, int count, unsigned char* mask) const {
+        for (int x = 0; x < count; x++) {
+            mask[x] = isWhite(row[x]) ? PIECE_MASK_WHITE : isBlack(row[x]) ? PIECE_MASK_BLACK : 0;
+        }
+    }
+};
+
+// Piece classes from the configured per-channel thresholds
+struct ThresholdPieceClasses {
+    int whiteAbove, blackBelow;
+    explicit ThresholdPieceClasses(const SiteDetectionConfig& config)
+        : whiteAbove(config.piece.whiteThreshold), blackBelow(config.piece.blackThreshold) {}
+    void PieceRow(const int* row, int count, unsigned char* mask) const {
+        PieceMaskRow(row, count, whiteAbove, blackBelow, mask);
+    }
+};
+
+// Analyze a square and return detection result with confidence
+inline SquareDetection AnalyzeSquare(int* buffer, int startX, int startY, int squareSize, 
+                                      int bufferWidth, const SiteDetectionConfig& config,
+                                      bool (*isWhite)(int), bool (*isBlack)(int)) {
+    TSquareStats stats;
+    stats.Build(FunctionPieceClasses(isWhite, isBlack), buffer + startY * bufferWidth + startX,
+                bufferWidth, squareSize, 1);
+    return SummarizeSquare(stats.Square(0, 0), config);
+}
+
+// Analyze a square using the configured piece thresholds
+inline SquareDetection AnalyzeSquare(int* buffer, int startX, int startY, int squareSize,
+                                      int bufferWidth, const SiteDetectionConfig& config) {
+    TSquareStats stats;
+    stats.Build(ThresholdPieceClasses(config), buffer + startY * bufferWidth + startX,
+                bufferWidth, squareSize, 1);
+    return SummarizeSquare(stats.Square(0, 0), config);
+}
+
 // Get overlay color for confidence level (for visualization)
 inline RGB GetConfidenceColor(ConfidenceLevel level) {
     switch (level) {
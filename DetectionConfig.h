@@ -42,9 +42,10 @@ struct RecognitionParams {
     int recognizeType;           // Recognition type (0=pixels, 1=square, 2=hybrid)
     int blackMax;                // Maximum black pixel count
     bool calcWhite;              // Calculate white pixels
+    int samples;                 // Sample lattice per square side, 0 = every pixel
     
     RecognitionParams() : width(0), depth(0), corner(0), recognizeType(1),
-                           blackMax(60), calcWhite(false) {}
+                           blackMax(60), calcWhite(false), samples(16) {}
 };
 
 // Complete detection configuration for a site/theme
@@ -57,8 +58,12 @@ struct SiteDetectionConfig {
     RGB lightSquareColor;        // Detected light square color
     RGB darkSquareColor;         // Detected dark square color
     bool colorsCalibrated;       // Whether colors have been calibrated
+    RGB whitePieceColor;         // Detected piece colors, when measured
+    RGB blackPieceColor;
+    bool whiteMeasured, blackMeasured;
+    unsigned int revision;       // Bumped whenever the settings change
     
-    SiteDetectionConfig() : colorsCalibrated(false) {}
+    SiteDetectionConfig() : colorsCalibrated(false), whiteMeasured(false), blackMeasured(false), revision(0) {}
     
     // Calculate adaptive thresholds based on detected square colors
     void CalibrateThresholds() {
@@ -85,6 +90,7 @@ struct SiteDetectionConfig {
         if (piece.blackThreshold < 0) piece.blackThreshold = 0;
         
         piece.useAdaptive = true;
+        revision++;
     }
 };
 
@@ -170,7 +176,7 @@ inline SiteDetectionConfig GetDefaultConfig(int programType) {
             config.recognition.recognizeType = 1;
             break;
             
-        case 9: // chesscom (defined as const int chesscom = 9 in TBoardCapture.h)
+        case 9: // chesscom (defined as const int chesscom = 9 in SitePolicies.h)
             // Chess.com boards typically have subtle borders with varied colors
             // Use adaptive detection for maximum flexibility across themes
             config.border.color = MakeBorderColor(84, 153, 119); // Green board default
@@ -184,7 +190,7 @@ inline SiteDetectionConfig GetDefaultConfig(int programType) {
             config.recognition.blackMax = 80;
             break;
             
-        case 10: // lichess (defined as const int lichess = 10 in TBoardCapture.h)
+        case 10: // lichess (defined as const int lichess = 10 in SitePolicies.h)
             // Lichess.org has clean borders and well-defined squares
             // Adaptive detection handles light/dark themes automatically
             config.border.color = MakeBorderColor(139, 125, 96); // Blue theme default
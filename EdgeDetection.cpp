@@ -0,0 +1,150 @@
+//---------------------------------------------------------------------------
+// TGradientImage: separable integer Sobel over a region. The gradients of
+// a candidate are computed once; all border and grid-line checks then read
+// the cached magnitudes or their row and column projections.
+//---------------------------------------------------------------------------
+#include "EdgeDetection.h"
+
+//---------------------------------------------------------------------------
+
+TGradientImage::TGradientImage()
+{
+  X = Y = W = H = 0;
+}
+
+void TGradientImage::Build(const int* buffer, int width, int height, int x, int y, int w, int h)
+{
+  if (x < 0) {
+    w += x;
+    x = 0;
+  }
+  if (y < 0) {
+    h += y;
+    y = 0;
+  }
+  if (x + w > width)
+    w = width - x;
+  if (y + h > height)
+    h = height - y;
+  if (w < 0)
+    w = 0;
+  if (h < 0)
+    h = 0;
+  X = x;
+  Y = y;
+  W = w;
+  H = h;
+  Magnitude.assign(W*H, 0);
+  Projections.clear();
+
+  // Pixels with all eight neighbours inside the image
+  int x0 = x > 1 ? x : 1;
+  int x1 = x + w < width - 1 ? x + w : width - 1;
+  int y0 = y > 1 ? y : 1;
+  int y1 = y + h < height - 1 ? y + h : height - 1;
+  if (x1 <= x0 || y1 <= y0)
+    return;
+  int n = x1 - x0;
+
+  // Horizontal pass into a ring of three rows: the [-1 0 1] difference
+  // and the [1 2 1] smoothing of the channel sums
+  Sums.resize(n + 2);
+  Diff.resize(3*n);
+  Smooth.resize(3*n);
+  int *sums = &Sums[0];
+  for (int row=y0-1; row<=y1; row++) {
+    const int *p = buffer + row*width + x0 - 1;
+    for (int i=0; i<n+2; i++) {
+      int c = p[i];
+      sums[i] = (c & 255) + ((c>>8) & 255) + ((c>>16) & 255);
+    }
+    int *diff = &Diff[(row % 3)*n];
+    int *smooth = &Smooth[(row % 3)*n];
+    for (int i=0; i<n; i++) {
+      diff[i] = sums[i+2] - sums[i];
+      smooth[i] = sums[i] + 2*sums[i+1] + sums[i+2];
+    }
+    if (row < y0 + 1)
+      continue;
+
+    // Vertical pass for the row above, now that its neighbours are in
+    int r = row - 1;
+    const int *dUp = &Diff[((r-1) % 3)*n];
+    const int *dMid = &Diff[(r % 3)*n];
+    const int *dDown = diff;
+    const int *sUp = &Smooth[((r-1) % 3)*n];
+    const int *sDown = smooth;
+    int *out = &Magnitude[(r-Y)*W + (x0-X)];
+    for (int i=0; i<n; i++) {
+      int gx = dUp[i] + 2*dMid[i] + dDown[i];
+      int gy = sDown[i] - sUp[i];
+      out[i] = gx*gx + gy*gy;
+    }
+  }
+}
+
+const TGradientImage::Projection& TGradientImage::ProjectionFor(int limit)
+{
+  for (size_t i=0; i<Projections.size(); i++)
+    if (Projections[i].limit == limit)
+      return Projections[i];
+
+  Projections.push_back(Projection());
+  Projection &p = Projections.back();
+  p.limit = limit;
+  p.rows.assign(H, 0);
+  p.columns.assign(W, 0);
+  if (W == 0 || H == 0)
+    return p;
+  // Locals keep the stores from aliasing W, so the loops vectorize
+  int w = W;
+  int *columns = &p.columns[0];
+  for (int y=0; y<H; y++) {
+    const int *m = &Magnitude[y*w];
+    int count = 0;
+    for (int x=0; x<w; x++) {
+      int edge = m[x] > limit;
+      count += edge;
+      columns[x] += edge;
+    }
+    p.rows[y] = count;
+  }
+  return p;
+}
+
+int TGradientImage::RowEdges(int y, int x0, int x1, double threshold)
+{
+  if (y < Y || y >= Y + H)
+    return 0;
+  int limit = GradientLimit(threshold);
+  if (x0 <= X && x1 >= X + W)
+    return ProjectionFor(limit).rows[y-Y];
+
+  if (x0 < X)
+    x0 = X;
+  if (x1 > X + W)
+    x1 = X + W;
+  const int *m = &Magnitude[(y-Y)*W - X];
+  int count = 0;
+  for (int x=x0; x<x1; x++)
+    count += m[x] > limit;
+  return count;
+}
+
+int TGradientImage::ColumnEdges(int x, int y0, int y1, double threshold)
+{
+  if (x < X || x >= X + W)
+    return 0;
+  int limit = GradientLimit(threshold);
+  if (y0 <= Y && y1 >= Y + H)
+    return ProjectionFor(limit).columns[x-X];
+
+  if (y0 < Y)
+    y0 = Y;
+  if (y1 > Y + H)
+    y1 = Y + H;
+  int count = 0;
+  for (int y=y0; y<y1; y++)
+    count += Magnitude[(y-Y)*W + (x-X)] > limit;
+  return count;
+}
@@ -3,6 +3,7 @@
 #define EdgeDetectionH
 
 #include <cmath>
+#include <vector>
 #include "ColorUtils.h"
 
 //---------------------------------------------------------------------------
@@ -44,6 +45,45 @@ inline double CalculateGradient(int* buffer, int x, int y, int width, int height
     return sqrt(gx*gx + gy*gy);
 }
 
+// Squared-magnitude limit matching CalculateGradient() > threshold: the
+// integer Sobel runs on r+g+b, three times the brightness used there
+inline int GradientLimit(double threshold) {
+    return threshold < 0 ? -1 : (int)floor(9.0 * threshold * threshold);
+}
+
+// Integer Sobel gradient of a whole region, computed in one separable
+// pass and kept for repeated line checks. Full-length row and column
+// checks are answered from cached projection sums in O(1).
+class TGradientImage {
+  public:
+    TGradientImage();
+    // Gradient of [x, x+w) x [y, y+h), clipped to the image; pixels on
+    // the image edge get 0 like CalculateGradient
+    void Build(const int* buffer, int width, int height, int x, int y, int w, int h);
+    // Forget the region, e.g. when a new frame was captured
+    void Reset() { X = Y = W = H = 0; }
+    bool Covers(int x, int y, int w, int h) const {
+        return x >= X && y >= Y && x + w <= X + W && y + h <= Y + H;
+    }
+    // Squared gradient magnitude of r+g+b at (x,y)
+    int MagnitudeSq(int x, int y) const { return Magnitude[(y - Y) * W + (x - X)]; }
+    // Pixels of row y with x0 <= x < x1 (or of column x with y0 <= y < y1)
+    // whose CalculateGradient() would exceed threshold
+    int RowEdges(int y, int x0, int x1, double threshold);
+    int ColumnEdges(int x, int y0, int y1, double threshold);
+  private:
+    struct Projection {
+        int limit;
+        std::vector<int> rows;     // Edge pixels per region row
+        std::vector<int> columns;  // Edge pixels per region column
+    };
+    int X, Y, W, H;
+    std::vector<int> Magnitude;
+    std::vector<int> Sums, Diff, Smooth;
+    std::vector<Projection> Projections;
+    const Projection& ProjectionFor(int limit);
+};
+
 // Detect if a horizontal line contains strong edges (potential board border)
 inline bool DetectHorizontalEdge(int* buffer, int y, int startX, int endX, int width, int height, double threshold = 50.0) {
     if (y <= 0 || y >= height - 1) {
@@ -90,8 +130,40 @@ inline bool DetectVerticalEdge(int* buffer, int x, int startY, int endY, int wid
     return totalCount > 0 && (double)edgeCount / totalCount > 0.6;
 }
 
+// DetectHorizontalEdge on a gradient image covering the line
+inline bool DetectHorizontalEdge(TGradientImage& gradients, int y, int startX, int endX, int width, int height, double threshold = 50.0) {
+    if (y <= 0 || y >= height - 1) {
+        return false;
+    }
+    
+    int x0 = startX > 1 ? startX : 1;
+    int x1 = endX < width - 1 ? endX : width - 1;
+    if (x1 <= x0) {
+        return false;
+    }
+    
+    // At least 60% of pixels should have strong edges for a board border
+    return (double)gradients.RowEdges(y, x0, x1, threshold) / (x1 - x0) > 0.6;
+}
+
+// DetectVerticalEdge on a gradient image covering the line
+inline bool DetectVerticalEdge(TGradientImage& gradients, int x, int startY, int endY, int width, int height, double threshold = 50.0) {
+    if (x <= 0 || x >= width - 1) {
+        return false;
+    }
+    
+    int y0 = startY > 1 ? startY : 1;
+    int y1 = endY < height - 1 ? endY : height - 1;
+    if (y1 <= y0) {
+        return false;
+    }
+    
+    // At least 60% of pixels should have strong edges for a board border
+    return (double)gradients.ColumnEdges(x, y0, y1, threshold) / (y1 - y0) > 0.6;
+}
+
 // Validate that a region has a grid pattern (for 8x8 chessboard)
-inline bool ValidateGridPattern(int* buffer, int x, int y, int size, int width, int height, double edgeThreshold = 40.0) {
+inline bool ValidateGridPattern(TGradientImage& gradients, int x, int y, int size, int width, int height, double edgeThreshold = 40.0) {
     if (x + size >= width || y + size >= height) {
         return false;
     }
@@ -107,7 +179,7 @@ inline bool ValidateGridPattern(int* buffer, int x, int y, int size, int width,
     // Check for vertical grid lines (7 internal lines for 8x8 board)
     for (int i = 1; i < 8; i++) {
         int gridX = x + i * squareSize;
-        if (DetectVerticalEdge(buffer, gridX, y, y + size, width, height, edgeThreshold)) {
+        if (DetectVerticalEdge(gradients, gridX, y, y + size, width, height, edgeThreshold)) {
             gridLineCount++;
         }
     }
@@ -115,7 +187,7 @@ inline bool ValidateGridPattern(int* buffer, int x, int y, int size, int width,
     // Check for horizontal grid lines (7 internal lines for 8x8 board)
     for (int i = 1; i < 8; i++) {
         int gridY = y + i * squareSize;
-        if (DetectHorizontalEdge(buffer, gridY, x, x + size, width, height, edgeThreshold)) {
+        if (DetectHorizontalEdge(gradients, gridY, x, x + size, width, height, edgeThreshold)) {
             gridLineCount++;
         }
     }
@@ -125,13 +197,26 @@ inline bool ValidateGridPattern(int* buffer, int x, int y, int size, int width,
     return gridLineCount >= expectedGridLines;
 }
 
-// Enhanced board detection using edge detection
-inline bool DetectBoardWithEdges(int* buffer, int x, int y, int size, int width, int height) {
+// Validate that a region has a grid pattern (for 8x8 chessboard)
+inline bool ValidateGridPattern(int* buffer, int x, int y, int size, int width, int height, double edgeThreshold = 40.0) {
+    TGradientImage gradients;
+    gradients.Build(buffer, width, height, x, y, size, size);
+    return ValidateGridPattern(gradients, x, y, size, width, height, edgeThreshold);
+}
+
+// Enhanced board detection using edge detection. The gradient of the
+// candidate is computed into gradients unless it already covers it, and
+// is shared by every check; Reset() it when the pixels change.
+inline bool DetectBoardWithEdges(TGradientImage& gradients, int* buffer, int x, int y, int size, int width, int height) {
+    if (!gradients.Covers(x, y, size, size)) {
+        gradients.Build(buffer, width, height, x, y, size, size);
+    }
+    
     // Check all four borders for strong edges
-    bool topEdge = DetectHorizontalEdge(buffer, y, x, x + size, width, height);
-    bool bottomEdge = DetectHorizontalEdge(buffer, y + size - 1, x, x + size, width, height);
-    bool leftEdge = DetectVerticalEdge(buffer, x, y, y + size, width, height);
-    bool rightEdge = DetectVerticalEdge(buffer, x + size - 1, y, y + size, width, height);
+    bool topEdge = DetectHorizontalEdge(gradients, y, x, x + size, width, height);
+    bool bottomEdge = DetectHorizontalEdge(gradients, y + size - 1, x, x + size, width, height);
+    bool leftEdge = DetectVerticalEdge(gradients, x, y, y + size, width, height);
+    bool rightEdge = DetectVerticalEdge(gradients, x + size - 1, y, y + size, width, height);
     
     // All four borders should have edges
     if (!(topEdge && bottomEdge && leftEdge && rightEdge)) {
@@ -139,32 +224,32 @@ inline bool DetectBoardWithEdges(int* buffer, int x, int y, int size, int width,
     }
     
     // Validate internal grid pattern
-    return ValidateGridPattern(buffer, x, y, size, width, height);
+    return ValidateGridPattern(gradients, x, y, size, width, height);
+}
+
+inline bool DetectBoardWithEdges(int* buffer, int x, int y, int size, int width, int height) {
+    TGradientImage gradients;
+    return DetectBoardWithEdges(gradients, buffer, x, y, size, width, height);
 }
 
 // Calculate edge density in a region
 inline double CalculateEdgeDensity(int* buffer, int x, int y, int width, int height, int regionWidth, int regionHeight, double threshold = 30.0) {
-    int edgeCount = 0;
-    int totalCount = 0;
+    int x0 = x > 1 ? x : 1;
+    int y0 = y > 1 ? y : 1;
+    int x1 = x + regionWidth < width - 1 ? x + regionWidth : width - 1;
+    int y1 = y + regionHeight < height - 1 ? y + regionHeight : height - 1;
+    if (x1 <= x0 || y1 <= y0) {
+        return 0.0;
+    }
     
-    for (int dy = 0; dy < regionHeight; dy++) {
-        for (int dx = 0; dx < regionWidth; dx++) {
-            int px = x + dx;
-            int py = y + dy;
-            
-            if (px <= 0 || px >= width - 1 || py <= 0 || py >= height - 1) {
-                continue;
-            }
-            
-            double gradient = CalculateGradient(buffer, px, py, width, height);
-            if (gradient > threshold) {
-                edgeCount++;
-            }
-            totalCount++;
-        }
+    TGradientImage gradients;
+    gradients.Build(buffer, width, height, x0, y0, x1 - x0, y1 - y0);
+    int edgeCount = 0;
+    for (int py = y0; py < y1; py++) {
+        edgeCount += gradients.RowEdges(py, x0, x1, threshold);
     }
     
-    return totalCount > 0 ? (double)edgeCount / totalCount : 0.0;
+    return (double)edgeCount / ((x1 - x0) * (y1 - y0));
 }
 
 #endif
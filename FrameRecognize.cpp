@@ -0,0 +1,723 @@
+//---------------------------------------------------------------------------
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include "FrameRecognize.h"
+
+#define X_COORD(x)  ((x)&7)
+#define Y_COORD(y)  ((y)>>3)
+
+const int parallel_min_squares = 16; // fewer are not worth waking the pool for
+const int sparse_min_spacing = 3;   // smaller squares are scanned pixel by pixel
+const int sparse_max_samples = 64;  // lattice points per side at most
+const int sparse_ambiguous = -2;    // the lattice can't tell, scan densely
+
+RecognitionParams SiteRecognitionParams(int programType, int boardSize, const RecognitionParams &configured)
+{
+   RecognitionParams params = configured;
+   int size = boardSize/8;
+   params.corner = size/8;
+   params.calcWhite = false;
+
+   switch (programType) {
+      case chessassistant:
+         params.width = size/4;
+         params.depth = 2;
+         params.corner = size/16;
+         params.recognizeType = 1;
+         break;
+      case chessbase:
+         params.width = size/4;
+         params.depth = 3;
+         params.corner = size/16;
+         params.recognizeType = 2;
+         params.blackMax = 180;
+         params.calcWhite = true;
+         break;
+      case bereg:
+         params.width = size/8;
+         params.depth = 4;
+         params.corner = size/16;
+         params.recognizeType = 1;
+         break;
+      case instantchess:
+         params.width = 7;
+         params.depth = 4;
+         params.corner = size/8;
+         params.recognizeType = 1;
+         params.blackMax = 60;
+         break;
+      case kurnik:
+         params.width = size/8;
+         params.depth = params.width;
+         params.corner = size/16;
+         params.recognizeType = 1;
+         break;
+      case winboard:
+         params.width = size/4;
+         params.depth = 3;
+         params.corner = size/16;
+         params.recognizeType = 1;
+         break;
+      case chessgate:
+         params.width = size/4;
+         params.depth = 3;
+         params.corner = size/16;
+         params.recognizeType = 2;
+         params.blackMax = 60;
+         break;
+      case spinchat:
+         params.width = size/6;
+         params.depth = 2;
+         params.corner = size/16;
+         params.recognizeType = 1;
+         break;
+      case chessclub_dasher:
+         params.width = size/6;
+         params.depth = 3;
+         params.corner = size/16;
+         params.recognizeType = 1;
+         break;
+      case chesscom: case lichess:
+         // Piece colours come from the adaptive policy; type and
+         // black_max stay as configured in detection.ini
+         params.width = size/4;
+         params.depth = 3;
+         params.corner = size/16;
+         break;
+   }
+   return params;
+}
+
+// Largest difference of a channel between two pixels
+static int ChannelDifference(int a, int b)
+{
+  int d = 0;
+  for (int c=0; c<24; c+=8) {
+    int dc = ((a>>c) & 255) - ((b>>c) & 255);
+    if (dc < 0)
+      dc = -dc;
+    if (dc > d)
+      d = dc;
+  }
+  return d;
+}
+
+bool FrameInTransit(const int *start, int stride, int boardSize, int light, int dark)
+{
+  int size = boardSize/8;
+  if (size < 8 || ChannelDifference(light, dark) < 2*transit_max_difference)
+    return false;
+  // A piece covers a boundary for much of a square when it crosses it;
+  // labels and piece tips at rest touch it for a few pixels at most
+  int min_run = size/3;
+  for (int k=1; k<8; k++) {
+    // Vertical boundary k: columns k*size - 1 and k*size
+    const int *left = start + k*size - 1;
+    int run = 0;
+    for (int y=0; y<8*size; y++, left+=stride) {
+      run = ChannelDifference(left[0], left[1]) <= transit_max_difference ? run + 1 : 0;
+      if (run >= min_run)
+        return true;
+    }
+    // Horizontal boundary k: rows k*size - 1 and k*size
+    const int *top = start + (k*size - 1)*stride;
+    run = 0;
+    for (int x=0; x<8*size; x++) {
+      run = ChannelDifference(top[x], top[x + stride]) <= transit_max_difference ? run + 1 : 0;
+      if (run >= min_run)
+        return true;
+    }
+  }
+  return false;
+}
+
+static int SquaredDistance(int a, int b)
+{
+  int d0 = (a & 255) - (b & 255);
+  int d1 = ((a>>8) & 255) - ((b>>8) & 255);
+  int d2 = ((a>>16) & 255) - ((b>>16) & 255);
+  return d0*d0 + d1*d1 + d2*d2;
+}
+
+// Largest channel, the HSV value
+static int Brightness(int colour)
+{
+  int b = colour & 255;
+  if (((colour>>8) & 255) > b)
+    b = (colour>>8) & 255;
+  if (((colour>>16) & 255) > b)
+    b = (colour>>16) & 255;
+  return b;
+}
+
+const int palette_texture = 40*40;       // Clusters this close to the square are its texture
+const int palette_cover = palette_samples*palette_samples*3/4;  // Samples of a square a highlight covers
+
+// Fixed-iteration k-means of samples into k centres, which come seeded;
+// returns the cluster of every sample in cluster and the sizes in counts
+static void ClusterColours(const std::vector<int> &samples, int *centres, int k,
+                           std::vector<unsigned char> &cluster, int *counts)
+{
+  cluster.resize(samples.size());
+  for (int it=0; it<=palette_iterations; it++) {
+    long sum[palette_clusters][3];
+    for (int j=0; j<k; j++) {
+      counts[j] = 0;
+      sum[j][0] = sum[j][1] = sum[j][2] = 0;
+    }
+    for (size_t i=0; i<samples.size(); i++) {
+      int best = 0;
+      int best_distance = SquaredDistance(samples[i], centres[0]);
+      for (int j=1; j<k; j++) {
+        int distance = SquaredDistance(samples[i], centres[j]);
+        if (distance < best_distance) {
+          best = j;
+          best_distance = distance;
+        }
+      }
+      cluster[i] = (unsigned char)best;
+      counts[best]++;
+      for (int c=0; c<3; c++)
+        sum[best][c] += (samples[i]>>(8*c)) & 255;
+    }
+    // The last round only assigns, so clusters and centres agree
+    if (it == palette_iterations)
+      break;
+    for (int j=0; j<k; j++)
+      if (counts[j])
+        centres[j] = (int)(sum[j][0]/counts[j]) | (int)(sum[j][1]/counts[j])<<8 |
+                     (int)(sum[j][2]/counts[j])<<16;
+  }
+}
+
+// Seeds the centres not given yet: the median sample first, then each
+// time the sample farthest from the centres so far
+static void SeedCentres(const std::vector<int> &samples, int *centres, int given, int k)
+{
+  if (given == 0) {
+    std::vector<int> channel(samples.size());
+    int median = 0;
+    for (int c=0; c<3; c++) {
+      for (size_t i=0; i<samples.size(); i++)
+        channel[i] = (samples[i]>>(8*c)) & 255;
+      std::nth_element(channel.begin(), channel.begin() + channel.size()/2, channel.end());
+      median |= channel[channel.size()/2]<<(8*c);
+    }
+    centres[given++] = median;
+  }
+  for (; given<k; given++) {
+    int farthest = samples[0], farthest_distance = -1;
+    for (size_t i=0; i<samples.size(); i++) {
+      int nearest = SquaredDistance(samples[i], centres[0]);
+      for (int j=1; j<given; j++) {
+        int distance = SquaredDistance(samples[i], centres[j]);
+        if (distance < nearest)
+          nearest = distance;
+      }
+      if (nearest > farthest_distance) {
+        farthest = samples[i];
+        farthest_distance = nearest;
+      }
+    }
+    centres[given] = farthest;
+  }
+}
+
+bool MeasureThemePalette(const int *start, int stride, int boardSize, ThemePalette &palette)
+{
+  int size = boardSize/8;
+  if (size < palette_samples)
+    return false;
+  int step = size/palette_samples;
+  // Samples of the light and the dark squares, a square's in a row
+  std::vector<int> samples[2];
+  for (int sq=0; sq<64; sq++) {
+    int light = ((X_COORD(sq) + Y_COORD(sq)) & 1) == 0 ? 1 : 0;
+    const int *origin = start + Y_COORD(sq)*size*stride + X_COORD(sq)*size;
+    for (int y=0; y<palette_samples; y++) {
+      const int *row = origin + (y*step + step/2)*stride;
+      for (int x=0; x<palette_samples; x++)
+        samples[light].push_back(row[x*step + step/2] & 0xFFFFFF);
+    }
+  }
+  ThemePalette result;
+  std::vector<int> pieces;
+  for (int light=0; light<2; light++) {
+    const std::vector<int> &v = samples[light];
+    int centres[palette_clusters];
+    int given = 0;
+    if (palette.valid) {
+      centres[given++] = PackColor(palette.square[light]);
+      if (palette.highlighted[light])
+        centres[given++] = PackColor(palette.highlight[light]);
+    }
+    SeedCentres(v, centres, given, palette_clusters);
+    std::vector<unsigned char> cluster;
+    int counts[palette_clusters];
+    ClusterColours(v, centres, palette_clusters, cluster, counts);
+    int base = 0;
+    for (int j=1; j<palette_clusters; j++)
+      if (counts[j] > counts[base])
+        base = j;
+    if (counts[base] < (int)v.size()/4)
+      return false;
+    // A texture's clusters join the square's, weighted by their sizes
+    bool square_part[palette_clusters];
+    long sum[3] = { 0, 0, 0 };
+    int total = 0;
+    for (int j=0; j<palette_clusters; j++) {
+      square_part[j] = j == base || (counts[j] && SquaredDistance(centres[j], centres[base]) <= palette_texture);
+      if (!square_part[j])
+        continue;
+      for (int c=0; c<3; c++)
+        sum[c] += (long)counts[j]*((centres[j]>>(8*c)) & 255);
+      total += counts[j];
+    }
+    int square = (int)(sum[0]/total) | (int)(sum[1]/total)<<8 | (int)(sum[2]/total)<<16;
+    result.square[light] = UnpackColor(square);
+    // A cluster that has a whole square to itself is a highlight
+    int covered[palette_clusters] = { 0 };
+    for (int s=0; s<32; s++) {
+      int count[palette_clusters] = { 0 };
+      for (int i=0; i<palette_samples*palette_samples; i++)
+        count[cluster[s*palette_samples*palette_samples + i]]++;
+      for (int j=0; j<palette_clusters; j++)
+        if (count[j] >= palette_cover)
+          covered[j]++;
+    }
+    int highlight = -1;
+    for (int j=0; j<palette_clusters; j++)
+      if (!square_part[j] && covered[j] && (highlight < 0 || counts[j] > counts[highlight]))
+        highlight = j;
+    if (highlight >= 0) {
+      result.highlighted[light] = true;
+      result.highlight[light] = UnpackColor(centres[highlight]);
+    }
+    for (int j=0; j<palette_clusters; j++)
+      if (!square_part[j] && j != highlight && counts[j] >= (int)v.size()/100)
+        pieces.push_back(centres[j]);
+  }
+  int light_square = PackColor(result.square[1]), dark_square = PackColor(result.square[0]);
+  if (Brightness(light_square) < Brightness(dark_square) ||
+      SquaredDistance(light_square, dark_square) <= palette_texture)
+    return false;
+  int middle = (Brightness(light_square) + Brightness(dark_square))/2;
+  for (size_t i=0; i<pieces.size(); i++) {
+    int b = Brightness(pieces[i]);
+    if (b > middle && (!result.hasWhite || b > Brightness(PackColor(result.whitePiece)))) {
+      result.hasWhite = true;
+      result.whitePiece = UnpackColor(pieces[i]);
+    }
+    if (b < middle && (!result.hasBlack || b < Brightness(PackColor(result.blackPiece)))) {
+      result.hasBlack = true;
+      result.blackPiece = UnpackColor(pieces[i]);
+    }
+  }
+  result.valid = true;
+  palette = result;
+  return true;
+}
+
+bool PaletteDrifted(const ThemePalette &palette, int light, int dark)
+{
+  return !palette.valid || ChannelDifference(PackColor(palette.square[1]), light) > palette_drift ||
+         ChannelDifference(PackColor(palette.square[0]), dark) > palette_drift;
+}
+
+static int CountSquares(uint64 squares)
+{
+  squares = squares - ((squares>>1) & U64(0x5555555555555555));
+  squares = (squares & U64(0x3333333333333333)) + ((squares>>2) & U64(0x3333333333333333));
+  squares = (squares + (squares>>4)) & U64(0x0F0F0F0F0F0F0F0F);
+  return (int)((squares*U64(0x0101010101010101))>>56);
+}
+
+int PieceOrientation(const TFindPos &pos)
+{
+  // Screen square 0 is top-left: the low 32 are the upper half
+  const uint64 upper = U64(0x00000000FFFFFFFF);
+  int white_upper = CountSquares(pos.find_pos[White] & upper);
+  int white_lower = CountSquares(pos.find_pos[White] & ~upper);
+  int black_upper = CountSquares(pos.find_pos[Black] & upper);
+  int black_lower = CountSquares(pos.find_pos[Black] & ~upper);
+  if (white_lower >= orientation_min_pieces && black_upper >= orientation_min_pieces &&
+      white_lower >= 3*white_upper && black_upper >= 3*black_lower)
+    return orientation_white_below;
+  if (white_upper >= orientation_min_pieces && black_lower >= orientation_min_pieces &&
+      white_upper >= 3*white_lower && black_lower >= 3*black_upper)
+    return orientation_white_above;
+  return orientation_unknown;
+}
+
+TSquareClassifier::TSquareClassifier()
+{
+  SquareSize = 0;
+  PolicySite = -1;
+  PolicyRevision = 0;
+  ClassifyFn = NULL;
+  SquareIsMarkedFn = NULL;
+}
+
+void TSquareClassifier::Setup(int programType, const SiteDetectionConfig &config, int boardSize)
+{
+  if (PolicySite != programType || PolicyRevision != config.revision) {
+    PolicyParams.Setup(programType, config);
+    SelectSitePolicy(programType, *this);
+    PolicySite = programType;
+    PolicyRevision = config.revision;
+  }
+  Params = SiteRecognitionParams(programType, boardSize, config.recognition);
+  SquareSize = boardSize/8;
+}
+
+template<class Policy>
+void TSquareClassifier::UsePolicy()
+{
+  ClassifyFn = &TSquareClassifier::ClassifySquares<Policy>;
+  SquareIsMarkedFn = &TSquareClassifier::CheckSquareMark<Policy>;
+}
+
+void TSquareClassifier::Classify(const int *start, int stride, uint64 squares, TFindPos &pos,
+                                 unsigned char *confidence, TWorkerPool *pool)
+{
+  if (squares)
+    (this->*ClassifyFn)(start, stride, squares, pos, confidence, pool);
+}
+
+template<class Policy>
+void TSquareClassifier::ClassifySquares(const int *start, int stride, uint64 squares, TFindPos &pos,
+                                        unsigned char *confidence, TWorkerPool *pool)
+{
+   Policy policy(PolicyParams);
+   int list[64];
+   int count = 0;
+   for (int i=0; i<64; i++)
+      if (squares & (((uint64)1)<<i))
+        list[count++] = i;
+   // Each square is built and classified on its own and only writes its
+   // own result; they are merged in square order afterwards, so the
+   // outcome is the same on any number of threads
+   int real_size = SquareSize - 2*Params.corner;
+   int samples = Params.samples < sparse_max_samples ? Params.samples : sparse_max_samples;
+   int dense[64];
+   int dense_count = 0;
+   if (samples > 0 && real_size >= samples*sparse_min_spacing) {
+      // Large squares read a lattice first and leave the pixel by pixel
+      // scan to the few it can't decide, so a frame costs about the same
+      // at any board size
+      std::function<void(int)> sample = [&](int k) {
+         int sq = list[k];
+         SquareStats estimate;
+         Results[sq].colour = SampleSquare(policy, start, stride, sq, samples, estimate);
+         if (Results[sq].colour != sparse_ambiguous)
+            Results[sq].confidence = RateSquare(estimate, Results[sq].colour);
+      };
+      if (pool && count >= parallel_min_squares)
+         pool->Run(count, sample);
+      else
+         for (int k=0; k<count; k++)
+           sample(k);
+      for (int k=0; k<count; k++)
+         if (Results[list[k]].colour == sparse_ambiguous)
+           dense[dense_count++] = list[k];
+   } else {
+      for (int k=0; k<count; k++)
+         dense[dense_count++] = list[k];
+   }
+   uint64 built = 0;
+   for (int k=0; k<dense_count; k++)
+      built |= ((uint64)1)<<dense[k];
+   Stats.Prepare(SquareSize, built, false);
+   std::function<void(int)> classify = [&](int k) {
+      int sq = dense[k];
+      Stats.BuildSquare(policy, start, stride, sq, false);
+      Results[sq].colour = RecognizeSquare(sq);
+      Results[sq].confidence = RateSquare(Stats.Rect(sq, Params.corner, Params.corner, real_size, real_size),
+                                          Results[sq].colour);
+   };
+   if (pool && dense_count >= parallel_min_squares)
+      pool->Run(dense_count, classify);
+   else
+      for (int k=0; k<dense_count; k++)
+        classify(k);
+   for (int k=0; k<count; k++) {
+      int i = list[k];
+      for (int c=0; c<ColourNb; c++)
+        pos.find_pos[c] &= ~(((uint64)1)<<i);
+      if (Results[i].colour != ColourNone)
+        pos.SetBit(Results[i].colour,i);
+      confidence[i] = (unsigned char)Results[i].confidence;
+   }
+}
+
+int TSquareClassifier::RecognizeSquare(int i)
+{
+   int size = SquareSize;
+   int corner = Params.corner;
+   int depth = Params.depth;
+   int width = Params.width;
+   int black_max = Params.blackMax;
+   bool calc_white = Params.calcWhite;
+
+   // Everything below reads the square's integral image: pixel counts are
+   // four lookups and a block search skips rows too sparse for a block
+   int real_size = size - 2*corner;
+   switch (Params.recognizeType) {
+     case 1:
+       if (FindPieceBlock(true,i,corner,real_size,real_size-depth+1,width,depth))
+         return White;
+       if (FindPieceBlock(false,i,corner,real_size,real_size-depth-1,width,depth))
+         return Black;
+       break;
+     case 2: {
+       SquareStats stats = Stats.Rect(i,corner,corner,real_size,real_size);
+       if ((calc_white ? stats.pieces : stats.black) > black_max) {
+         if (FindPieceBlock(false,i,corner,real_size,real_size-depth-1,width,depth))
+           return Black;
+         return White;
+       }
+       break;
+     }
+     case 3:
+       break;
+   }
+   return ColourNone;
+}
+
+// How sure a reading is, from the piece pixels of the square's scan area
+// (or of its lattice): a piece with little of its own colour, or an
+// empty square with some piece pixels, lies close to the thresholds that
+// decided it. The contrast of a piece is its own colour's pixels over
+// the other's.
+ConfidenceLevel TSquareClassifier::RateSquare(const SquareStats &stats, int colour)
+{
+  if (colour == ColourNone) {
+    switch (CalculateDetectionConfidence(stats.white, stats.black, stats.pixels, 0.0)) {
+      case CONFIDENCE_NONE: return stats.pixels ? CONFIDENCE_HIGH : CONFIDENCE_NONE;
+      case CONFIDENCE_LOW:  return CONFIDENCE_MEDIUM;
+      default:              return CONFIDENCE_LOW;
+    }
+  }
+  int own = colour == White ? stats.white : stats.black;
+  int other = colour == White ? stats.black : stats.white;
+  return CalculateDetectionConfidence(own, 0, stats.pixels, (double)(own + 1)/(other + 1));
+}
+
+// Lattice points set in a row mask
+static int CountPoints(uint64 points)
+{
+  int count = 0;
+  for (; points; points &= points - 1)
+    count++;
+  return count;
+}
+
+// Reading of square sq from a samples x samples lattice over its scan
+// area, or sparse_ambiguous. A piece block spans a few lattice points
+// each way, so a block of them stands for the dense block search; no
+// piece point at all is an empty square. Type 1 stops at a white block
+// once the rest can't change the rating. estimate gets the counts of
+// the points, for RateSquare; a square whose rating the lattice can't
+// be sure of is sparse_ambiguous too, so it rates as the dense scan.
+template<class Policy>
+int TSquareClassifier::SampleSquare(const Policy &policy, const int *start, int stride, int sq, int samples,
+                                    SquareStats &estimate)
+{
+   int size = SquareSize;
+   int corner = Params.corner;
+   int real_size = size - 2*corner;
+   int spacing = real_size/samples;
+   int block_width = (Params.width + spacing)/spacing + 1;
+   int block_depth = (Params.depth + spacing - 1)/spacing + 1;
+   if (block_width < 2)
+     block_width = 2;
+   if (block_width > samples)
+     block_width = samples;
+   if (block_depth < 2)
+     block_depth = 2;
+   if (block_depth > samples)
+     block_depth = samples;
+   // Points of each colour straight above and including each lattice point
+   unsigned char white_run[sparse_max_samples], black_run[sparse_max_samples];
+   memset(white_run, 0, sizeof(white_run));
+   memset(black_run, 0, sizeof(black_run));
+   // Each point stands in the middle of its share of the scan area, so
+   // the lattice spans all of it whatever the rounding of the spacing
+   int offset[sparse_max_samples];
+   for (int i=0; i<samples; i++)
+     offset[i] = (2*i + 1)*real_size/(2*samples);
+   const int *origin = start + (Y_COORD(sq)*size + corner)*stride + X_COORD(sq)*size + corner;
+   int white = 0, black = 0, pieces = 0, edges = 0;
+   uint64 white_above = 0, black_above = 0;
+   uint64 row_points = ~(uint64)0 >> (64 - samples);
+   bool white_block = false, black_block = false;
+   for (int y=0; y<samples; y++) {
+     const int *row = origin + offset[y]*stride;
+     int white_columns = 0, black_columns = 0;
+     uint64 white_row = 0, black_row = 0;
+     for (int x=0; x<samples; x++) {
+       int pixel = row[offset[x]];
+       bool is_white = policy.White(pixel);
+       bool is_black = policy.Black(pixel);
+       white_row |= (uint64)is_white << x;
+       black_row |= (uint64)is_black << x;
+       white += is_white;
+       black += is_black;
+       pieces += is_white || is_black;
+       white_run[x] = is_white ? white_run[x] + 1 : 0;
+       black_run[x] = is_black ? black_run[x] + 1 : 0;
+       white_columns = white_run[x] >= block_depth ? white_columns + 1 : 0;
+       black_columns = black_run[x] >= block_depth ? black_columns + 1 : 0;
+       if (white_columns >= block_width)
+         white_block = true;
+       if (black_columns >= block_width)
+         black_block = true;
+     }
+     // A point of another colour than the one left of or above it is on
+     // an edge, which lies in one of the two points' half cells
+     edges += CountPoints(((white_row ^ white_row<<1) | (black_row ^ black_row<<1)) & row_points & ~(uint64)1);
+     if (y > 0)
+       edges += CountPoints((white_row ^ white_above) | (black_row ^ black_above));
+     white_above = white_row;
+     black_above = black_row;
+     // A white block decides type 1 whatever else the square holds; the
+     // rest is read only while it could still change how sure that is
+     int unread = samples*(samples - y - 1);
+     int margin = (edges + 1)/2;
+     if (white_block && Params.recognizeType == 1 && 10*(white - margin) > 3*samples*samples &&
+         white - margin + 1 > 2*(black + margin + unread + 1))
+       break;
+   }
+   // Rated over the whole lattice; points left unread can only add to
+   // the white of an early exit
+   estimate.pixels = samples*samples;
+   estimate.white = white;
+   estimate.black = black;
+   estimate.pieces = pieces;
+   int colour = sparse_ambiguous;
+   switch (Params.recognizeType) {
+     case 1:
+       if (white_block)
+         colour = White;
+       else if (!pieces)
+         colour = ColourNone;
+       else if (black_block && !white)
+         colour = Black;
+       break;
+     case 2: {
+       // The piece pixels the points stand for against the site's limit,
+       // with a margin either way
+       int seen = Params.calcWhite ? pieces : black;
+       long found = (long)seen*real_size*real_size/(samples*samples);
+       if (!seen || 2*found < Params.blackMax)
+         colour = ColourNone;
+       else if (found <= 2*Params.blackMax)
+         break;
+       else if (black_block)
+         colour = Black;
+       else if (!black)
+         colour = White;
+       break;
+     }
+     case 3:
+       colour = ColourNone;
+       break;
+   }
+   if (colour == sparse_ambiguous)
+     return colour;
+   // The rating must hold with each edge half a point more or less of
+   // its colour, else it is the dense scan's. It rises with a colour's
+   // points and falls with the other's, so the extremes decide
+   int margin = (edges + 1)/2;
+   ConfidenceLevel rating = RateSquare(estimate, colour);
+   for (int i=0; i<4; i++) {
+     SquareStats bound = estimate;
+     bound.white = std::min(std::max(white + ((i & 1) ? margin : -margin), 0), bound.pixels);
+     bound.black = std::min(std::max(black + ((i & 2) ? margin : -margin), 0), bound.pixels);
+     if (RateSquare(bound, colour) != rating)
+       return sparse_ambiguous;
+   }
+   return colour;
+}
+
+// Whether the size x size pixels at (corner,corner) of square sq hold a
+// block of white (or black) piece pixels more than width wide and depth
+// high, whose top row is one of the first rows. That is what the nested
+// runs of the former recursive row scan amounted to: a run wider than
+// width on every row, each inside the one above.
+bool TSquareClassifier::FindPieceBlock(bool white, int sq, int corner, int size, int rows, int width, int depth)
+{
+  if (rows <= 0)
+    return false;
+  if (depth <= 0)
+    return true;
+  int last = rows + depth - 1;
+  if (last > size)
+    last = size;
+  return Stats.HasBlock(sq, corner, corner, size, last, width < 0 ? 1 : width + 1, depth, white);
+}
+
+bool TSquareClassifier::SquareIsMarked(const int *start, int stride, int sq)
+{
+  return (this->*SquareIsMarkedFn)(start, stride, sq);
+}
+
+template<class Policy>
+bool TSquareClassifier::CheckSquareMark(const int *start, int stride, int sq)
+{
+  Policy policy(PolicyParams);
+  int size = SquareSize;
+  const int *cur = start + Y_COORD(sq)*size*stride + X_COORD(sq)*size + size/2;
+  for (int i=0; i<4; i++) {
+    if (policy.Mark(*cur))
+      return true;
+    cur += stride;
+  }
+  return false;
+}
+
+BoardObservation RecognizeFrame(const int *pixels, int stride, int width, int height, const BoardRect &rect,
+                                int programType, const SiteDetectionConfig &config, TWorkerPool *pool)
+{
+  BoardObservation observation;
+  if (!pixels || width > stride || rect.size < 8 || rect.x < 0 || rect.y < 0 ||
+      rect.x + rect.size + 4 > width || rect.y + rect.size + 4 > height)
+    return observation;
+  TSquareClassifier classifier;
+  classifier.Setup(programType, config, rect.size);
+  const int *start = pixels + (rect.y + 2)*stride + rect.x + 2;
+  observation.FindPos.Init();
+  classifier.Classify(start, stride, ~(uint64)0, observation.FindPos, observation.confidence, pool);
+  observation.recognized = true;
+  observation.params = classifier.Params;
+  observation.squareSize = classifier.SquareSize;
+  return observation;
+}
+
+TObservationFilter::TObservationFilter()
+{
+  Reset();
+}
+
+void TObservationFilter::Reset()
+{
+  Valid = false;
+}
+
+bool TObservationFilter::Update(const TFindPos &pos, const unsigned char *confidence, unsigned int time)
+{
+  bool settled = true;
+  for (int i=0; i<64; i++) {
+    uint64 bit = ((uint64)1)<<i;
+    int reading = (pos.find_pos[White] & bit) ? White : (pos.find_pos[Black] & bit) ? Black : ColourNone;
+    if (!Valid || reading != Reading[i]) {
+      Reading[i] = reading;
+      Since[i] = time;
+    }
+    if (confidence[i] < CONFIDENCE_HIGH && time - Since[i] < filter_settle_ms)
+      settled = false;
+  }
+  Valid = true;
+  return settled;
+}
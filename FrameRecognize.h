@@ -0,0 +1,162 @@
+//---------------------------------------------------------------------------
+
+#ifndef FrameRecognizeH
+#define FrameRecognizeH
+
+#include "find_pos.h"
+#include "TBoardCapture.h"
+#include "SquareStats.h"
+#include "DebugOverlay.h"
+#include "WorkerPool.h"
+//---------------------------------------------------------------------------
+// Piece colours of a board as a function of the pixels and the site
+// settings alone. Nothing here reads or writes a capture or a shared
+// config, so recorded frames can be recognized on any number of threads
+// at once, one classifier per thread.
+//---------------------------------------------------------------------------
+
+// What a frame showed of one board
+struct BoardObservation {
+    bool recognized;             // False when the rect can't hold a board
+    TFindPos FindPos;            // Squares with a white or black piece
+    unsigned char confidence[64];  // ConfidenceLevel of each square's reading
+    RecognitionParams params;    // Scan settings used at this board size
+    int squareSize;
+
+    BoardObservation() : recognized(false), squareSize(0) {
+        memset(confidence, CONFIDENCE_NONE, sizeof(confidence));
+    }
+};
+
+// Scan settings of a site at a board size: the configured ones, with the
+// site's own width, depth and corner (and for most sites type) over them
+RecognitionParams SiteRecognitionParams(int programType, int boardSize, const RecognitionParams &configured);
+
+// Colours of a board theme, found by clustering samples of all 64
+// squares. Light and dark squares are told apart by their place on the
+// screen, so this holds on flipped boards and in any position. For each
+// square colour the commonest cluster is the empty square (with the
+// clusters close to it, a texture); a cluster that covers a whole
+// square elsewhere is the last move highlight, and the rest are pieces.
+// Colours are in UnpackColor order like SiteDetectionConfig's.
+struct ThemePalette {
+    bool valid;
+    RGB square[2];               // Dark (0) and light (1) squares
+    bool highlighted[2];
+    RGB highlight[2];            // Highlighted dark and light squares
+    bool hasWhite, hasBlack;
+    RGB whitePiece, blackPiece;  // Brightest and darkest piece colours
+
+    ThemePalette() : valid(false), hasWhite(false), hasBlack(false) {
+        highlighted[0] = highlighted[1] = false;
+    }
+};
+
+const int palette_clusters = 4;          // Colours per square colour
+const int palette_iterations = 6;        // Fixed k-means rounds
+const int palette_samples = 8;           // Samples per square side
+
+// Palette of the board whose top-left square starts at start. A palette
+// that is valid on entry seeds the clusters, so re-measuring a theme
+// that drifted a little settles at once. False when the squares don't
+// show two distinct square colours.
+bool MeasureThemePalette(const int *start, int stride, int boardSize, ThemePalette &palette);
+// Whether the square colours of the screen (pixels) moved away from the
+// palette's, so it should be measured again
+const int palette_drift = 16;            // Largest channel difference still the same colour
+bool PaletteDrifted(const ThemePalette &palette, int light, int dark);
+
+// Site classification of the squares of a board. Keeps the policy
+// picked for the site and the integral images of the squares, so a
+// classifier reused from frame to frame allocates nothing.
+class TSquareClassifier {
+  public:
+    TSquareClassifier();
+    // Policy and scan settings for a site at a board size; cheap while
+    // site, config revision and size stay the same
+    void Setup(int programType, const SiteDetectionConfig &config, int boardSize);
+    // Classifies the squares whose bit is set, of the board whose top-left
+    // square starts at start, into pos and how sure each reading is into
+    // confidence; the other squares are kept. The squares go to pool when
+    // enough of them change at once; results don't depend on it.
+    void Classify(const int *start, int stride, uint64 squares, TFindPos &pos, unsigned char *confidence,
+                  TWorkerPool *pool);
+    // Whether square sq carries the site's move highlight
+    bool SquareIsMarked(const int *start, int stride, int sq);
+    RecognitionParams Params;
+    int SquareSize;
+    // Integral images of the squares, rebuilt whenever they are classified
+    TSquareStats Stats;
+  private:
+    // Square scans instantiated for the site policy, picked once per site
+    int PolicySite;
+    unsigned int PolicyRevision;
+    SitePolicyParams PolicyParams;
+    void (TSquareClassifier::*ClassifyFn)(const int *start, int stride, uint64 squares,
+                                          TFindPos &pos, unsigned char *confidence, TWorkerPool *pool);
+    bool (TSquareClassifier::*SquareIsMarkedFn)(const int *start, int stride, int sq);
+    template<class Policy> void UsePolicy();
+    template<class Target> friend void SelectSitePolicy(int programType, Target &target);
+    template<class Policy> void ClassifySquares(const int *start, int stride, uint64 squares,
+                                                TFindPos &pos, unsigned char *confidence, TWorkerPool *pool);
+    template<class Policy> bool CheckSquareMark(const int *start, int stride, int sq);
+    int RecognizeSquare(int sq);
+    ConfidenceLevel RateSquare(const SquareStats &stats, int colour);
+    template<class Policy> int SampleSquare(const Policy &policy, const int *start, int stride, int sq,
+                                            int samples, SquareStats &estimate);
+    bool FindPieceBlock(bool white, int sq, int corner, int size, int rows, int width, int depth);
+    // Colour found for each square, a cache line apart so the workers
+    // writing them don't share lines
+    struct SquareResult {
+        int colour;
+        int confidence;
+        char pad[56];
+    };
+    SquareResult Results[64];
+};
+
+// Whether a piece straddles a square boundary, as it does in the frames
+// of a move animation. At rest the pixels either side of a boundary
+// belong to a light and a dark square and differ like those do; where a
+// sliding piece covers the boundary they match. light and dark are the
+// theme's square colours; a theme whose squares differ too little to
+// tell is never in transit.
+const int transit_max_difference = 24;   // Largest channel difference of matching pixels
+bool FrameInTransit(const int *start, int stride, int boardSize, int light, int dark);
+
+// Side of the screen White plays from, by where the pieces of each colour
+// stand: most of either side's pieces in its own half, as in the start
+// position and the openings, decide it; other positions are unknown.
+const int orientation_unknown = 0;
+const int orientation_white_below = 1;   // White moves up the screen
+const int orientation_white_above = 2;
+const int orientation_min_pieces = 4;    // Pieces of a side in its half that decide
+int PieceOrientation(const TFindPos &pos);
+
+// Settles the readings of consecutive frames of a board. A square read
+// with high confidence is taken from the frame it first appears in; any
+// other must read the same for filter_settle_ms of frame time, the wait
+// a second capture used to add to every change.
+const unsigned int filter_settle_ms = 50;
+
+class TObservationFilter {
+  public:
+    TObservationFilter();
+    // Forget the readings, e.g. when the board was lost
+    void Reset();
+    // Feeds the reading of a frame captured at time (ms); true when every
+    // square has settled, i.e. pos can be trusted
+    bool Update(const TFindPos &pos, const unsigned char *confidence, unsigned int time);
+  private:
+    int Reading[64];
+    unsigned int Since[64];      // Time of the first frame with the reading
+    bool Valid;
+};
+
+// All 64 squares of the board at rect (as TBoardCapture tracks it: one
+// pixel outside the border line) of a frame of width x height pixels,
+// stride pixels per row; not recognized when rect leaves the frame
+BoardObservation RecognizeFrame(const int *pixels, int stride, int width, int height, const BoardRect &rect,
+                                int programType, const SiteDetectionConfig &config, TWorkerPool *pool = NULL);
+
+#endif
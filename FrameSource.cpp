@@ -0,0 +1,455 @@
+//---------------------------------------------------------------------------
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include "FrameSource.h"
+
+//---------------------------------------------------------------------------
+
+#ifdef _WIN32
+TGdiFrameSource::TGdiFrameSource()
+{
+  HDC screendc = GetDC(NULL);
+  int BitsPerPixel = GetDeviceCaps(screendc, BITSPIXEL);
+  if (BitsPerPixel < 32) {
+    ReleaseDC(0, screendc);
+    throw "Screen resolution is wrong";
+  }
+  ScreenSizeX = GetDeviceCaps(screendc, HORZRES);
+  ScreenSizeY = GetDeviceCaps(screendc, VERTRES);
+  ReleaseDC(0, screendc);
+  // The buffer grows on the first Grab, so sources that only ever
+  // capture a board rectangle never hold a whole screen
+  ScreenBuffer = NULL;
+  BufferSize = 0;
+}
+
+TGdiFrameSource::~TGdiFrameSource()
+{
+  free(ScreenBuffer);
+}
+
+bool TGdiFrameSource::GetScreenSize(int &width, int &height)
+{
+  width = ScreenSizeX;
+  height = ScreenSizeY;
+  return true;
+}
+
+bool TGdiFrameSource::Grab(int x, int y, int width, int height, CapturedFrame &frame)
+{
+  if (width <= 0 || height <= 0 || width * height > ScreenSizeX * ScreenSizeY)
+    return false;
+  if (width * height > BufferSize) {
+    int *buffer = (int *)realloc(ScreenBuffer, width * height * 4);
+    if (buffer == NULL)
+      throw "Memory not allocated";
+    ScreenBuffer = buffer;
+    BufferSize = width * height;
+  }
+  BITMAPINFO BitmapInfo;
+  memset(&BitmapInfo, 0, sizeof(BITMAPINFO));
+  BitmapInfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+  BitmapInfo.bmiHeader.biWidth = width;
+  BitmapInfo.bmiHeader.biHeight = -height;
+  BitmapInfo.bmiHeader.biPlanes = 1;
+  BitmapInfo.bmiHeader.biBitCount = 32;
+  BitmapInfo.bmiHeader.biCompression = BI_BITFIELDS;
+  BitmapInfo.bmiHeader.biSizeImage = width * height * 4;
+  BitmapInfo.bmiHeader.biClrUsed = 0;
+  BitmapInfo.bmiHeader.biClrImportant = 0;
+
+  HDC screendc = GetDC(NULL);
+  HDC dc = CreateCompatibleDC(screendc);
+  HBITMAP Bitmap = CreateCompatibleBitmap(screendc, width, height);
+  HGDIOBJ Handle = SelectObject(dc, Bitmap);
+  BitBlt(dc, 0, 0, width, height, screendc, x, y, SRCCOPY);
+  int lines = GetDIBits(dc, Bitmap, 0, height, ScreenBuffer, &BitmapInfo, DIB_RGB_COLORS);
+  DeleteObject(SelectObject(dc, Handle));
+  DeleteDC(dc);
+  ReleaseDC(0, screendc);
+  if (lines == 0)
+    return false;
+
+  frame.pixels = ScreenBuffer;
+  frame.stride = width;
+  frame.width = width;
+  frame.height = height;
+  frame.timestamp = GetTickCount();
+  return true;
+}
+#endif
+
+//---------------------------------------------------------------------------
+
+void CopyFrameRegion(const CapturedFrame &image, int x, int y, int width, int height,
+                     std::vector<int> &region)
+{
+  region.assign(width * height, 0);
+  int from = x < 0 ? -x : 0;
+  int to = x + width > image.width ? image.width - x : width;
+  if (from >= to)
+    return;
+  for (int row = 0; row < height; row++) {
+    int sy = y + row;
+    if (sy < 0 || sy >= image.height)
+      continue;
+    memcpy(&region[row * width + from], image.pixels + sy * image.stride + x + from,
+           (to - from) * sizeof(int));
+  }
+}
+
+TFrameViewSource::TFrameViewSource()
+{
+}
+
+void TFrameViewSource::SetFrame(const CapturedFrame &frame)
+{
+  View = frame;
+}
+
+bool TFrameViewSource::GetScreenSize(int &width, int &height)
+{
+  width = View.width;
+  height = View.height;
+  return View.pixels != NULL;
+}
+
+bool TFrameViewSource::Grab(int x, int y, int width, int height, CapturedFrame &frame)
+{
+  if (View.pixels == NULL || width <= 0 || height <= 0)
+    return false;
+  CopyFrameRegion(View, x, y, width, height, Region);
+  frame.pixels = &Region[0];
+  frame.stride = width;
+  frame.width = width;
+  frame.height = height;
+  frame.timestamp = View.timestamp;
+  return true;
+}
+
+//---------------------------------------------------------------------------
+
+TMemoryFrameSource::TMemoryFrameSource()
+{
+  ImageSizeX = 0;
+  ImageSizeY = 0;
+  Timestamp = 0;
+}
+
+bool TMemoryFrameSource::GetScreenSize(int &width, int &height)
+{
+  width = ImageSizeX;
+  height = ImageSizeY;
+  return ImageSizeX > 0 && ImageSizeY > 0;
+}
+
+bool TMemoryFrameSource::Grab(int x, int y, int width, int height, CapturedFrame &frame)
+{
+  if (ImageSizeX <= 0 || ImageSizeY <= 0 || width <= 0 || height <= 0)
+    return false;
+  frame.stride = width;
+  frame.width = width;
+  frame.height = height;
+  frame.timestamp = Timestamp;
+  if (x == 0 && y == 0 && width == ImageSizeX && height == ImageSizeY) {
+    // Whole image: hand it out without a copy
+    frame.pixels = &Image[0];
+    return true;
+  }
+  CapturedFrame image;
+  image.pixels = &Image[0];
+  image.stride = image.width = ImageSizeX;
+  image.height = ImageSizeY;
+  CopyFrameRegion(image, x, y, width, height, Region);
+  frame.pixels = &Region[0];
+  return true;
+}
+
+void TMemoryFrameSource::SetImage(const int *pixels, int width, int height, int stride)
+{
+  ImageSizeX = width;
+  ImageSizeY = height;
+  Image.resize(width * height);
+  for (int y = 0; y < height; y++)
+    memcpy(&Image[y * width], pixels + y * stride, width * sizeof(int));
+}
+
+//---------------------------------------------------------------------------
+
+TSyntheticFrameSource::TSyntheticFrameSource(int width, int height)
+{
+  ImageSizeX = width;
+  ImageSizeY = height;
+  Image.assign(width * height, 0);
+}
+
+void TSyntheticFrameSource::Clear(int color)
+{
+  Image.assign(ImageSizeX * ImageSizeY, color);
+}
+
+void TSyntheticFrameSource::FillRect(int x, int y, int width, int height, int color)
+{
+  int x0 = x < 0 ? 0 : x;
+  int y0 = y < 0 ? 0 : y;
+  int x1 = x + width > ImageSizeX ? ImageSizeX : x + width;
+  int y1 = y + height > ImageSizeY ? ImageSizeY : y + height;
+  for (int py = y0; py < y1; py++) {
+    int *cur = &Image[py * ImageSizeX + x0];
+    for (int px = x0; px < x1; px++)
+      *cur++ = color;
+  }
+}
+
+void TSyntheticFrameSource::RenderBoard(int x, int y, int boardSize, const SyntheticBoardStyle &style,
+                                        uint64 white, uint64 black)
+{
+  int size = boardSize / 8;
+  // One pixel border line around the squares, as TBoardCapture expects
+  FillRect(x - 1, y - 1, boardSize + 2, boardSize + 2, style.border);
+  for (int i = 0; i < 64; i++) {
+    int sx = x + (i & 7) * size;
+    int sy = y + (i >> 3) * size;
+    bool light = (((i & 7) + (i >> 3)) & 1) == 0;
+    FillRect(sx, sy, size, size, light ? style.lightSquare : style.darkSquare);
+    int piece = size / 4;
+    if ((white >> i) & 1)
+      FillRect(sx + piece, sy + piece, size - 2 * piece, size - 2 * piece, style.whitePiece);
+    else if ((black >> i) & 1)
+      FillRect(sx + piece, sy + piece, size - 2 * piece, size - 2 * piece, style.blackPiece);
+  }
+  // Fill the remainder when boardSize is not a multiple of 8
+  FillRect(x + 8 * size, y, boardSize - 8 * size, boardSize, style.darkSquare);
+  FillRect(x, y + 8 * size, boardSize, boardSize - 8 * size, style.darkSquare);
+}
+
+void TSyntheticFrameSource::RenderPosition(int x, int y, int boardSize, const SyntheticBoardStyle &style,
+                                           const int pieces[64])
+{
+  // Glyph rectangles in sixteenths of a square: a common base, then a
+  // head that tells the piece type apart
+  static const int glyphs[6][4][4] = {
+    { { 4, 8, 8, 4 }, { 7, 6, 2, 2 } },                                     // Pawn
+    { { 4, 8, 8, 4 }, { 6, 4, 3, 4 }, { 4, 4, 2, 2 } },                     // Knight
+    { { 4, 8, 8, 4 }, { 7, 3, 2, 5 } },                                     // Bishop
+    { { 4, 8, 8, 4 }, { 5, 5, 6, 3 }, { 5, 4, 1, 1 }, { 10, 4, 1, 1 } },    // Rook
+    { { 4, 8, 8, 4 }, { 5, 3, 1, 5 }, { 7, 2, 2, 6 }, { 10, 3, 1, 5 } },    // Queen
+    { { 4, 8, 8, 4 }, { 7, 1, 2, 7 }, { 5, 3, 6, 2 } },                     // King
+  };
+  RenderBoard(x, y, boardSize, style, 0, 0);
+  int size = boardSize / 8;
+  for (int i = 0; i < 64; i++) {
+    if (pieces[i] < 0)
+      continue;
+    int sx = x + (i & 7) * size;
+    int sy = y + (i >> 3) * size;
+    int color = (pieces[i] & 1) ? style.blackPiece : style.whitePiece;
+    const int (*glyph)[4] = glyphs[(pieces[i] >> 1) % 6];
+    for (int r = 0; r < 4 && glyph[r][2] > 0; r++) {
+      int x0 = sx + glyph[r][0] * size / 16;
+      int y0 = sy + glyph[r][1] * size / 16;
+      int x1 = sx + (glyph[r][0] + glyph[r][2]) * size / 16;
+      int y1 = sy + (glyph[r][1] + glyph[r][3]) * size / 16;
+      FillRect(x0, y0, x1 - x0, y1 - y0, color);
+    }
+  }
+}
+
+void TSyntheticFrameSource::AdvanceTime(unsigned int ms)
+{
+  Timestamp += ms;
+}
+
+//---------------------------------------------------------------------------
+
+TFileFrameSource::TFileFrameSource()
+{
+  CurrentFrame = -1;
+  FrameInterval = 33;
+  Loop = false;
+  RawSizeX = 0;
+  RawSizeY = 0;
+}
+
+void TFileFrameSource::AddFile(const std::string &FileName)
+{
+  Files.push_back(FileName);
+}
+
+int TFileFrameSource::AddSequence(const std::string &NamePattern, int First)
+{
+  int added = 0;
+  char name[1024];
+  for (int i = First; ; i++) {
+    snprintf(name, sizeof(name), NamePattern.c_str(), i);
+    FILE *f = fopen(name, "rb");
+    if (f == NULL)
+      break;
+    fclose(f);
+    Files.push_back(name);
+    added++;
+  }
+  return added;
+}
+
+void TFileFrameSource::SetRawSize(int width, int height)
+{
+  RawSizeX = width;
+  RawSizeY = height;
+}
+
+int TFileFrameSource::FrameCount()
+{
+  return (int)Files.size();
+}
+
+bool TFileFrameSource::NextFrame()
+{
+  if (Files.empty())
+    return false;
+  int next = CurrentFrame + 1;
+  if (next >= (int)Files.size()) {
+    if (!Loop)
+      return false;
+    next = 0;
+  }
+  if (!LoadFile(Files[next]))
+    return false;
+  if (CurrentFrame >= 0)
+    Timestamp += FrameInterval;
+  CurrentFrame = next;
+  return true;
+}
+
+bool TFileFrameSource::LoadFile(const std::string &FileName)
+{
+  size_t dot = FileName.rfind('.');
+  std::string ext = dot == std::string::npos ? "" : FileName.substr(dot + 1);
+  for (size_t i = 0; i < ext.length(); i++)
+    ext[i] = tolower((unsigned char)ext[i]);
+  FILE *f = fopen(FileName.c_str(), "rb");
+  if (f == NULL)
+    return false;
+  bool res;
+  if (ext == "ppm")
+    res = LoadPPM(f);
+  else if (ext == "bmp")
+    res = LoadBMP(f);
+  else
+    res = LoadRaw(f);
+  fclose(f);
+  if (!res) {
+    ImageSizeX = 0;
+    ImageSizeY = 0;
+  }
+  return res;
+}
+
+static bool ReadPPMInt(FILE *f, int &value)
+{
+  int c = fgetc(f);
+  while (c != EOF && (isspace(c) || c == '#')) {
+    if (c == '#')
+      while (c != EOF && c != '\n')
+        c = fgetc(f);
+    c = fgetc(f);
+  }
+  if (c == EOF || !isdigit(c))
+    return false;
+  value = 0;
+  while (c != EOF && isdigit(c)) {
+    value = value * 10 + (c - '0');
+    c = fgetc(f);
+  }
+  return true;
+}
+
+bool TFileFrameSource::LoadPPM(FILE *f)
+{
+  // Binary P6 with 8-bit channels
+  if (fgetc(f) != 'P' || fgetc(f) != '6')
+    return false;
+  int width, height, maxval;
+  if (!ReadPPMInt(f, width) || !ReadPPMInt(f, height) || !ReadPPMInt(f, maxval))
+    return false;
+  if (width <= 0 || height <= 0 || maxval <= 0 || maxval > 255)
+    return false;
+  std::vector<unsigned char> row(width * 3);
+  Image.resize(width * height);
+  for (int y = 0; y < height; y++) {
+    if (fread(&row[0], 1, row.size(), f) != row.size())
+      return false;
+    for (int x = 0; x < width; x++)
+      Image[y * width + x] = MakeScreenColor(row[x * 3], row[x * 3 + 1], row[x * 3 + 2]);
+  }
+  ImageSizeX = width;
+  ImageSizeY = height;
+  return true;
+}
+
+static int ReadLE(const unsigned char *p, int bytes)
+{
+  int value = 0;
+  for (int i = bytes - 1; i >= 0; i--)
+    value = (value << 8) | p[i];
+  return value;
+}
+
+bool TFileFrameSource::LoadBMP(FILE *f)
+{
+  // Uncompressed 24 or 32 bits per pixel, bottom-up or top-down
+  unsigned char header[54];
+  if (fread(header, 1, sizeof(header), f) != sizeof(header))
+    return false;
+  if (header[0] != 'B' || header[1] != 'M')
+    return false;
+  int offset = ReadLE(header + 10, 4);
+  int width = ReadLE(header + 18, 4);
+  int height = ReadLE(header + 22, 4);
+  int bits = ReadLE(header + 28, 2);
+  int compression = ReadLE(header + 30, 4);
+  if (bits != 24 && bits != 32)
+    return false;
+  if (compression != 0 && !(compression == 3 && bits == 32))
+    return false;
+  bool top_down = height < 0;
+  if (top_down)
+    height = -height;
+  if (width <= 0 || height <= 0)
+    return false;
+  int bytes = bits / 8;
+  int pitch = (width * bytes + 3) & ~3;
+  std::vector<unsigned char> row(pitch);
+  if (fseek(f, offset, SEEK_SET) != 0)
+    return false;
+  Image.resize(width * height);
+  for (int i = 0; i < height; i++) {
+    if (fread(&row[0], 1, pitch, f) != (size_t)pitch)
+      return false;
+    int y = top_down ? i : height - 1 - i;
+    for (int x = 0; x < width; x++) {
+      unsigned char *p = &row[x * bytes];
+      Image[y * width + x] = MakeScreenColor(p[2], p[1], p[0]);
+    }
+  }
+  ImageSizeX = width;
+  ImageSizeY = height;
+  return true;
+}
+
+bool TFileFrameSource::LoadRaw(FILE *f)
+{
+  // Headerless dump of GetDIBits output, size given by SetRawSize
+  if (RawSizeX <= 0 || RawSizeY <= 0)
+    return false;
+  Image.resize(RawSizeX * RawSizeY);
+  if (fread(&Image[0], sizeof(int), Image.size(), f) != Image.size())
+    return false;
+  ImageSizeX = RawSizeX;
+  ImageSizeY = RawSizeY;
+  return true;
+}
@@ -0,0 +1,147 @@
+//---------------------------------------------------------------------------
+
+#ifndef FrameSourceH
+#define FrameSourceH
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "util.h"
+//---------------------------------------------------------------------------
+// Frame sources hand screen pixels to TBoardCapture. Pixels are packed
+// 32-bit integers in the layout GetDIBits produces (0x00RRGGBB), so the
+// capture and recognition code does not care where a frame came from.
+//---------------------------------------------------------------------------
+
+// One captured rectangle of the screen
+struct CapturedFrame {
+    int* pixels;                 // First pixel of the rectangle
+    int stride;                  // Row pitch in pixels
+    int width;
+    int height;
+    unsigned int timestamp;      // Capture time in milliseconds
+
+    CapturedFrame() : pixels(0), stride(0), width(0), height(0), timestamp(0) {}
+};
+
+// Pack RGB components in screen (GetDIBits) pixel order
+inline int MakeScreenColor(int r, int g, int b) {
+    return (r << 16) | (g << 8) | b;
+}
+
+class TFrameSource {
+  public:
+    virtual ~TFrameSource() {}
+    // Size of the whole area the source can capture
+    virtual bool GetScreenSize(int &width, int &height) = 0;
+    // Capture a rectangle given in screen coordinates. The pixels stay
+    // valid until the next call to Grab. Area outside the screen is black.
+    virtual bool Grab(int x, int y, int width, int height, CapturedFrame &frame) = 0;
+};
+
+#ifdef _WIN32
+// Live desktop capture through GDI (BitBlt + GetDIBits)
+class TGdiFrameSource : public TFrameSource {
+  public:
+    TGdiFrameSource();
+    ~TGdiFrameSource();
+    bool GetScreenSize(int &width, int &height);
+    bool Grab(int x, int y, int width, int height, CapturedFrame &frame);
+  private:
+    int *ScreenBuffer;
+    int BufferSize;
+    int ScreenSizeX, ScreenSizeY;
+};
+#endif
+
+// Copy a rectangle out of a larger image; area outside it is black
+void CopyFrameRegion(const CapturedFrame &image, int x, int y, int width, int height,
+                     std::vector<int> &region);
+
+// Serves crops of a frame owned elsewhere, e.g. one screen capture
+// shared by several tracked boards
+class TFrameViewSource : public TFrameSource {
+  public:
+    TFrameViewSource();
+    void SetFrame(const CapturedFrame &frame);
+    bool GetScreenSize(int &width, int &height);
+    bool Grab(int x, int y, int width, int height, CapturedFrame &frame);
+  private:
+    CapturedFrame View;
+    std::vector<int> Region;
+};
+
+// Serves frames from an image held in memory
+class TMemoryFrameSource : public TFrameSource {
+  public:
+    TMemoryFrameSource();
+    bool GetScreenSize(int &width, int &height);
+    bool Grab(int x, int y, int width, int height, CapturedFrame &frame);
+    void SetImage(const int *pixels, int width, int height, int stride);
+    unsigned int Timestamp;
+  protected:
+    std::vector<int> Image;
+    int ImageSizeX, ImageSizeY;
+  private:
+    std::vector<int> Region;
+};
+
+// Board colours used by TSyntheticFrameSource::RenderBoard
+struct SyntheticBoardStyle {
+    int background;
+    int border;
+    int lightSquare;
+    int darkSquare;
+    int whitePiece;
+    int blackPiece;
+
+    SyntheticBoardStyle()
+        : background(MakeScreenColor(128, 128, 160)),
+          border(MakeScreenColor(0, 0, 0)),
+          lightSquare(MakeScreenColor(238, 216, 170)),
+          darkSquare(MakeScreenColor(170, 120, 80)),
+          whitePiece(MakeScreenColor(255, 255, 255)),
+          blackPiece(MakeScreenColor(0, 0, 0)) {}
+};
+
+// In-memory canvas for generated test and benchmark frames
+class TSyntheticFrameSource : public TMemoryFrameSource {
+  public:
+    TSyntheticFrameSource(int width, int height);
+    void Clear(int color);
+    void FillRect(int x, int y, int width, int height, int color);
+    // Draw a board whose squares start at (x,y). Bit i of the masks is
+    // square i counted from the top-left corner, like TFindPos.
+    void RenderBoard(int x, int y, int boardSize, const SyntheticBoardStyle &style,
+                     uint64 white, uint64 black);
+    // Same board with a distinct glyph per piece type. pieces[i] is the
+    // piece on square i in fruit's 12-index (WhitePawn12 ..), or negative
+    // for an empty square.
+    void RenderPosition(int x, int y, int boardSize, const SyntheticBoardStyle &style,
+                        const int pieces[64]);
+    void AdvanceTime(unsigned int ms);
+};
+
+// Plays back recorded frames (PPM, BMP or headerless 32-bit raw files)
+class TFileFrameSource : public TMemoryFrameSource {
+  public:
+    TFileFrameSource();
+    void AddFile(const std::string &FileName);
+    // Add the files named by a printf-style pattern, from First while they exist
+    int AddSequence(const std::string &NamePattern, int First);
+    void SetRawSize(int width, int height);
+    bool NextFrame();
+    int FrameCount();
+    int CurrentFrame;
+    unsigned int FrameInterval;
+    bool Loop;
+  private:
+    std::vector<std::string> Files;
+    int RawSizeX, RawSizeY;
+    bool LoadFile(const std::string &FileName);
+    bool LoadPPM(FILE *f);
+    bool LoadBMP(FILE *f);
+    bool LoadRaw(FILE *f);
+};
+
+#endif
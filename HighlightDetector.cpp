@@ -0,0 +1,152 @@
+//---------------------------------------------------------------------------
+#include "HighlightDetector.h"
+
+#define X_COORD(x)  ((x)&7)
+#define Y_COORD(y)  ((y)>>3)
+
+const int highlight_max_samples = 64;    // Older tints fade out beyond this
+
+static int ColourDistance(int a, int b)
+{
+  int d0 = (a & 255) - (b & 255);
+  int d1 = ((a>>8) & 255) - ((b>>8) & 255);
+  int d2 = ((a>>16) & 255) - ((b>>16) & 255);
+  return d0*d0 + d1*d1 + d2*d2;
+}
+
+static int ClampChannel(int c)
+{
+  return c < 0 ? 0 : c > 255 ? 255 : c;
+}
+
+THighlightDetector::THighlightDetector()
+{
+  Base[0] = Base[1] = 0;
+  HasBase = false;
+  Clear();
+}
+
+void THighlightDetector::Clear()
+{
+  for (int l=0; l<2; l++) {
+    TintCount[l] = 0;
+    for (int c=0; c<3; c++)
+      TintSum[l][c] = 0;
+  }
+}
+
+void THighlightDetector::SetSquareColours(int light, int dark)
+{
+  Base[1] = light & 0xFFFFFF;
+  Base[0] = dark & 0xFFFFFF;
+  HasBase = true;
+}
+
+void THighlightDetector::SetTint(int light, int colour)
+{
+  if (!HasBase || TintCount[light])
+    return;
+  if (ColourDistance(colour, Base[light]) < highlight_min_tint)
+    return;
+  for (int c=0; c<3; c++)
+    TintSum[light][c] = ((colour>>(8*c)) & 255) - ((Base[light]>>(8*c)) & 255);
+  TintCount[light] = 1;
+}
+
+bool THighlightDetector::Ready() const
+{
+  return HasBase && (TintCount[0] > 0 || TintCount[1] > 0);
+}
+
+void THighlightDetector::Corners(const int *start, int stride, int size, int sq, int corners[4])
+{
+  int inset = size/16;
+  const int *origin = start + Y_COORD(sq)*size*stride + X_COORD(sq)*size;
+  const int *top = origin + inset*stride;
+  const int *bottom = origin + (size - 1 - inset)*stride;
+  corners[0] = top[inset] & 0xFFFFFF;
+  corners[1] = top[size - 1 - inset] & 0xFFFFFF;
+  corners[2] = bottom[inset] & 0xFFFFFF;
+  corners[3] = bottom[size - 1 - inset] & 0xFFFFFF;
+}
+
+int THighlightDetector::Tinted(int light) const
+{
+  // Until a square colour has been seen highlighted itself, the change
+  // learned on the other one stands in
+  int learned = TintCount[light] ? light : 1 - light;
+  int colour = 0;
+  for (int c=0; c<3; c++) {
+    int base = (Base[light]>>(8*c)) & 255;
+    colour |= ClampChannel(base + TintSum[learned][c]/TintCount[learned])<<(8*c);
+  }
+  return colour;
+}
+
+void THighlightDetector::Learn(const int *start, int stride, int size, uint64 squares)
+{
+  if (!HasBase || size < 16)
+    return;
+  for (int sq=0; sq<64; sq++) {
+    if (!(squares & (((uint64)1)<<sq)))
+      continue;
+    int light = ((X_COORD(sq) + Y_COORD(sq)) & 1) == 0 ? 1 : 0;
+    int corners[4];
+    Corners(start, stride, size, sq, corners);
+    // The corners off the plain square colour; a coordinate label in
+    // one corner must not count, so at least two have to agree
+    int sum[3] = { 0, 0, 0 };
+    int count = 0;
+    for (int k=0; k<4; k++) {
+      if (ColourDistance(corners[k], Base[light]) < highlight_min_tint)
+        continue;
+      if (count && ColourDistance(corners[k], corners[0]) > highlight_limit)
+        continue;
+      if (!count)
+        corners[0] = corners[k];
+      for (int c=0; c<3; c++)
+        sum[c] += (corners[k]>>(8*c)) & 255;
+      count++;
+    }
+    if (count < 2)
+      continue;
+    int seen = 0;
+    for (int c=0; c<3; c++)
+      seen |= (sum[c]/count)<<(8*c);
+    // A tint unlike the one learned so far (another highlight style)
+    // starts over rather than blending the two
+    if (TintCount[light] && ColourDistance(seen, Tinted(light)) > highlight_limit)
+      TintCount[light] = 0;
+    if (TintCount[light] == 0)
+      for (int c=0; c<3; c++)
+        TintSum[light][c] = 0;
+    if (TintCount[light] >= highlight_max_samples) {
+      for (int c=0; c<3; c++)
+        TintSum[light][c] /= 2;
+      TintCount[light] /= 2;
+    }
+    for (int c=0; c<3; c++)
+      TintSum[light][c] += ((seen>>(8*c)) & 255) - ((Base[light]>>(8*c)) & 255);
+    TintCount[light]++;
+  }
+}
+
+uint64 THighlightDetector::Detect(const int *start, int stride, int size) const
+{
+  if (!Ready() || size < 16)
+    return 0;
+  int tinted[2] = { Tinted(0), Tinted(1) };
+  uint64 squares = 0;
+  for (int sq=0; sq<64; sq++) {
+    int light = ((X_COORD(sq) + Y_COORD(sq)) & 1) == 0 ? 1 : 0;
+    int corners[4];
+    Corners(start, stride, size, sq, corners);
+    int hits = 0;
+    for (int k=0; k<4; k++)
+      if (ColourDistance(corners[k], tinted[light]) <= highlight_limit)
+        hits++;
+    if (hits >= 2)
+      squares |= ((uint64)1)<<sq;
+  }
+  return squares;
+}
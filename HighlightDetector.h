@@ -0,0 +1,48 @@
+//---------------------------------------------------------------------------
+
+#ifndef HighlightDetectorH
+#define HighlightDetectorH
+
+#include "my_util.h"
+//---------------------------------------------------------------------------
+// Last move highlight of a board. Sites tint the from and to squares of
+// the last move; the tint is learned per theme, as the change it makes to
+// the light and to the dark square colour, from squares known to carry
+// it. A square is read from the pixels near its four corners, which
+// pieces rarely reach, and counts as highlighted when most of them show
+// the tinted colour.
+//---------------------------------------------------------------------------
+
+const int highlight_min_tint = 24*24;    // Smaller changes of the square colour are no highlight
+const int highlight_limit = 20*20*3;     // Largest squared RGB distance still the tint
+
+class THighlightDetector {
+  public:
+    THighlightDetector();
+    // Forget the learned tints, e.g. for another theme
+    void Clear();
+    // Colours of the empty light and dark squares, as screen pixels
+    void SetSquareColours(int light, int dark);
+    // Highlighted colour of the light (1) or dark (0) squares as measured
+    // elsewhere (a theme palette); kept only while none is learned
+    void SetTint(int light, int colour);
+    // A tint known for the light or the dark squares
+    bool Ready() const;
+    // Learn from the squares whose bit is set, which show the highlight,
+    // of the board whose top-left square starts at start; squares that
+    // show their plain colour teach nothing
+    void Learn(const int *start, int stride, int size, uint64 squares);
+    // Squares showing a learned tint
+    uint64 Detect(const int *start, int stride, int size) const;
+  private:
+    int Base[2];                 // Square colour, dark (0) and light (1)
+    bool HasBase;
+    int TintSum[2][3];           // Sum of the learned changes per channel
+    int TintCount[2];
+    // Pixels near the corners of square sq
+    static void Corners(const int *start, int stride, int size, int sq, int corners[4]);
+    // Colour of a light or dark square with the learned tint; needs Ready()
+    int Tinted(int light) const;
+};
+
+#endif
@@ -0,0 +1,277 @@
+//---------------------------------------------------------------------------
+#include "MoveReconstruct.h"
+#include "move_do.h"
+#include "move_gen.h"
+#include "square.h"
+#include <algorithm>
+#include <cstring>
+
+//---------------------------------------------------------------------------
+
+static int CountSquares(uint64 squares)
+{
+  int count = 0;
+  for (; squares; squares &= squares - 1)
+    count++;
+  return count;
+}
+
+void MoveOccupancy(const board_t *board, int move, uint64 occupancy[ColourNb])
+{
+  int me = board->turn;
+  int opp = COLOUR_OPP(me);
+  int from = MOVE_FROM(move);
+  int to = MOVE_TO(move);
+  occupancy[me] = board->occupancy[me] ^ (SQUARE_OCCUPANCY(from) | SQUARE_OCCUPANCY(to));
+  occupancy[opp] = board->occupancy[opp];
+  if (MOVE_IS_EN_PASSANT(move))
+    occupancy[opp] &= ~SQUARE_OCCUPANCY(SQUARE_EP_DUAL(to));
+  else if (board->square[to] != Empty)
+    occupancy[opp] &= ~SQUARE_OCCUPANCY(to);
+  if (MOVE_IS_CASTLE(move)) {
+    // The king's move is from and to; the rook's follows from where to is
+    if (to == G1)
+      occupancy[me] ^= SQUARE_OCCUPANCY(H1) | SQUARE_OCCUPANCY(F1);
+    else if (to == C1)
+      occupancy[me] ^= SQUARE_OCCUPANCY(A1) | SQUARE_OCCUPANCY(D1);
+    else if (to == G8)
+      occupancy[me] ^= SQUARE_OCCUPANCY(H8) | SQUARE_OCCUPANCY(F8);
+    else if (to == C8)
+      occupancy[me] ^= SQUARE_OCCUPANCY(A8) | SQUARE_OCCUPANCY(D8);
+  }
+}
+
+bool MoveReaches(const board_t *board, int move, const TFindPos &target)
+{
+  uint64 occupancy[ColourNb];
+  MoveOccupancy(board, move, occupancy);
+  return occupancy[White] == target.find_pos[White] && occupancy[Black] == target.find_pos[Black];
+}
+
+bool ReconstructMoves(board_t *board, const TFindPos &target, const list_t *list, mv_t pv[3], int *nodes)
+{
+  int me = board->turn;
+  int opp = COLOUR_OPP(me);
+  int made = 0;
+  // Whoever moves first leaves one of these; nothing of its own can come
+  // back there, as the reply is the other side's
+  uint64 vacated = board->occupancy[me] & ~target.find_pos[me];
+  bool found = false;
+  for (int i=0; i<LIST_SIZE(list) && !found; i++) {
+    mv_t move = LIST_MOVE(list,i);
+    if ((vacated & SQUARE_OCCUPANCY(MOVE_FROM(move))) && MoveReaches(board,move,target)) {
+      pv[0] = move;
+      pv[1] = 0;
+      found = true;
+    }
+  }
+  for (int i=0; i<LIST_SIZE(list) && !found; i++) {
+    mv_t move = LIST_MOVE(list,i);
+    if (!(vacated & SQUARE_OCCUPANCY(MOVE_FROM(move))))
+      continue;
+    // After the reply the first mover has what it had after its move,
+    // less at most the square the reply captured on; and the reply
+    // leaves a square the target shows empty of the other side
+    uint64 occupancy[ColourNb];
+    MoveOccupancy(board,move,occupancy);
+    if ((target.find_pos[me] & ~occupancy[me]) != 0 ||
+        CountSquares(occupancy[me] & ~target.find_pos[me]) > 1)
+      continue;
+    uint64 replied = occupancy[opp] & ~target.find_pos[opp];
+    if (!replied)
+      continue;
+    undo_t undo;
+    move_do(board,move,&undo);
+    made++;
+    list_t list2;
+    gen_legal_moves(&list2,board);
+    for (int j=0; j<LIST_SIZE(&list2); j++) {
+      mv_t move2 = LIST_MOVE(&list2,j);
+      if ((replied & SQUARE_OCCUPANCY(MOVE_FROM(move2))) && MoveReaches(board,move2,target)) {
+        pv[0] = move;
+        pv[1] = move2;
+        pv[2] = 0;
+        found = true;
+        break;
+      }
+    }
+    move_undo(board,move,&undo);
+  }
+  if (nodes)
+    *nodes = made;
+  return found;
+}
+
+// Whether a side with occupancy, turn to move and castling flags can
+// show target after plies moves
+static bool CanReach(const uint64 occupancy[ColourNb], int turn, int flags, const TFindPos &target, int plies)
+{
+  if (plies == 0)
+    return occupancy[White] == target.find_pos[White] && occupancy[Black] == target.find_pos[Black];
+  for (int colour=0; colour<ColourNb; colour++) {
+    int moves = colour == turn ? (plies + 1) / 2 : plies / 2;
+    int replies = plies - moves;
+    int castles = COLOUR_IS_WHITE(colour) ? FlagsWhiteKingCastle | FlagsWhiteQueenCastle
+                                          : FlagsBlackKingCastle | FlagsBlackQueenCastle;
+    // Squares the side's moves can reach; castling reaches two at once
+    int fills = moves == 0 ? 0 : moves + ((flags & castles) ? 1 : 0);
+    uint64 have = occupancy[colour];
+    uint64 want = target.find_pos[colour];
+    if (CountSquares(want & ~have) > fills)
+      return false;
+    // Pieces are only ever lost, one per move of the other side
+    int lost = CountSquares(have) - CountSquares(want);
+    if (lost < 0 || lost > replies)
+      return false;
+    if (CountSquares(have & ~want) > fills + replies)
+      return false;
+  }
+  return true;
+}
+
+TLineReconstructor::TLineReconstructor()
+  : Nodes(0), Table(1 << reconstruct_table_bits), Target(NULL), Budget(0), Line(NULL), Found(false), FoundKey(0)
+{
+}
+
+ReconstructResult TLineReconstructor::Search(board_t *board, const TFindPos &target, int plies, int budget, mv_t line[])
+{
+  Nodes = 0;
+  Target = &target;
+  Budget = budget;
+  Line = line;
+  Found = false;
+  line[0] = 0;
+  if (plies > reconstruct_max_plies)
+    plies = reconstruct_max_plies;
+  if (CanReach(board->occupancy,board->turn,board->flags,target,0))
+    return RECONSTRUCT_FOUND;
+  for (int length=1; length<=plies; length++) {
+    if (!CanReach(board->occupancy,board->turn,board->flags,target,length))
+      continue;
+    Searched empty = {0, 0};
+    std::fill(Table.begin(),Table.end(),empty);
+    Visit(board->key,length);
+    ReconstructResult result = SearchPlies(board,0,length);
+    if (result != RECONSTRUCT_NONE)
+      return result;
+    if (Found)
+      return RECONSTRUCT_FOUND;
+  }
+  return RECONSTRUCT_NONE;
+}
+
+// Lines of exactly plies more moves after Path[0..ply-1]. NONE goes on
+// searching; AMBIGUOUS and BUDGET end the search.
+ReconstructResult TLineReconstructor::SearchPlies(board_t *board, int ply, int plies)
+{
+  list_t list;
+  gen_legal_moves(&list,board);
+  for (int i=0; i<LIST_SIZE(&list); i++) {
+    mv_t move = LIST_MOVE(&list,i);
+    uint64 occupancy[ColourNb];
+    MoveOccupancy(board,move,occupancy);
+    if (!CanReach(occupancy,COLOUR_OPP(board->turn),board->flags,*Target,plies-1))
+      continue;
+    if (Nodes >= Budget)
+      return RECONSTRUCT_BUDGET;
+    undo_t undo;
+    move_do(board,move,&undo);
+    Nodes++;
+    Path[ply] = move;
+    ReconstructResult result = RECONSTRUCT_NONE;
+    if (plies == 1) {
+      if (!Found) {
+        Found = true;
+        FoundKey = board->key;
+        for (int j=0; j<=reconstruct_max_plies; j++)
+          Line[j] = j <= ply ? Path[j] : 0;
+      }
+      else if (board->key != FoundKey)
+        result = RECONSTRUCT_AMBIGUOUS;
+    }
+    else if (Visit(board->key,plies-1))
+      result = SearchPlies(board,ply+1,plies-1);
+    move_undo(board,move,&undo);
+    if (result != RECONSTRUCT_NONE)
+      return result;
+  }
+  return RECONSTRUCT_NONE;
+}
+
+// Records a position about to be searched with plies left; false when it
+// already was. A full run of slots just leaves the position unrecorded.
+bool TLineReconstructor::Visit(uint64 key, int plies)
+{
+  int mask = (1 << reconstruct_table_bits) - 1;
+  for (int i=0; i<reconstruct_table_probes; i++) {
+    Searched &slot = Table[(int(key) + i) & mask];
+    if (slot.plies == 0) {
+      slot.key = key;
+      slot.plies = plies;
+      return true;
+    }
+    if (slot.key == key && slot.plies == plies)
+      return false;
+  }
+  return true;
+}
+
+// Bucket of a pair; the occupancy is mixed in so that the readings of
+// one board don't all compete for one bucket
+static int MemoIndex(const board_t *board, const TFindPos &target)
+{
+  uint64 hash = board->key ^ target.find_pos[White] * U64(0x9E3779B97F4A7C15)
+                            ^ target.find_pos[Black] * U64(0xC2B2AE3D27D4EB4F);
+  return int(hash >> (64 - reconstruct_memo_bits));
+}
+
+TReconstructMemo::TReconstructMemo()
+  : Storage(sizeof(Bucket)*((1 << reconstruct_memo_bits) + 1))
+{
+  size_t line = sizeof(Bucket);
+  Buckets = (Bucket *)(((size_t)&Storage[0] + line - 1) & ~(line - 1));
+  Clear();
+}
+
+void TReconstructMemo::Clear()
+{
+  memset(Buckets,0,sizeof(Bucket) << reconstruct_memo_bits);
+}
+
+bool TReconstructMemo::Probe(const board_t *board, const TFindPos &target, ReconstructResult &result, mv_t pv[]) const
+{
+  const Bucket &bucket = Buckets[MemoIndex(board,target)];
+  for (int i=0; i<2; i++) {
+    const Entry &entry = bucket.entry[i];
+    if (entry.stored && entry.key == board->key && entry.occupancy[White] == target.find_pos[White] &&
+        entry.occupancy[Black] == target.find_pos[Black]) {
+      result = ReconstructResult(entry.result);
+      for (int j=0; j<memo_moves; j++)
+        pv[j] = entry.pv[j];
+      pv[memo_moves] = 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+void TReconstructMemo::Store(const board_t *board, const TFindPos &target, ReconstructResult result, const mv_t pv[])
+{
+  Entry entry;
+  memset(&entry,0,sizeof(entry));
+  if (result == RECONSTRUCT_FOUND)
+    for (int j=0; pv[j]; j++) {
+      if (j == memo_moves)
+        return;
+      entry.pv[j] = pv[j];
+    }
+  entry.key = board->key;
+  entry.occupancy[White] = target.find_pos[White];
+  entry.occupancy[Black] = target.find_pos[Black];
+  entry.result = (unsigned char)result;
+  entry.stored = true;
+  Bucket &bucket = Buckets[MemoIndex(board,target)];
+  bucket.entry[1] = bucket.entry[0];
+  bucket.entry[0] = entry;
+}
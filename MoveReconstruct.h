@@ -0,0 +1,122 @@
+//---------------------------------------------------------------------------
+
+#ifndef MoveReconstructH
+#define MoveReconstructH
+
+#include "board.h"
+#include "list.h"
+#include "move.h"
+#include "find_pos.h"
+#include <vector>
+//---------------------------------------------------------------------------
+// Moves that explain a change of the recognized position. The squares
+// each side vacated and filled (the old occupancy XOR the new one) tell
+// which moves can have been played: a move must leave from a vacated
+// square, and whatever else it touches (the square it captures on, the
+// pawn taken en passant, the castling rook) shows in the occupancy it
+// leaves. That occupancy is predicted from the board without making the
+// move, so only the first moves of two-ply changes are ever made.
+//---------------------------------------------------------------------------
+
+// Occupancy of board after move, in TFindPos numbering
+void MoveOccupancy(const board_t *board, int move, uint64 occupancy[ColourNb]);
+// Whether making move on board shows target
+bool MoveReaches(const board_t *board, int move, const TFindPos &target);
+
+// One or two plies from board (whose legal moves are list) to target;
+// pv gets the moves, ended by 0. Moves are tried in list order, so of
+// moves that look the same (the promotions) the first generated wins,
+// as it did when every move was made. nodes, when given, gets the
+// number of moves made.
+bool ReconstructMoves(board_t *board, const TFindPos &target, const list_t *list, mv_t pv[3], int *nodes = NULL);
+
+// Outcome of TLineReconstructor::Search
+enum ReconstructResult {
+    RECONSTRUCT_NONE = 0,        // No line of at most the plies allowed
+    RECONSTRUCT_FOUND = 1,       // The shortest lines all end in one position
+    RECONSTRUCT_AMBIGUOUS = 2,   // Shortest lines end in different positions
+    RECONSTRUCT_BUDGET = 3       // The node budget ran out before that was known
+};
+
+const int reconstruct_max_plies = 6;        // Longest line searched
+const int reconstruct_node_budget = 20000;  // Moves made per search at most
+const int reconstruct_table_bits = 12;      // Transposition set of 1<<bits positions
+const int reconstruct_table_probes = 4;     // Slots tried per position
+
+// Lines of several plies to a recognized position, for when frames were
+// missed while moves were played (bullet, premoves). Lengths are tried
+// from one ply up, so the line found is a shortest one. A move is only
+// made when the occupancy it leaves can still reach the target in the
+// plies left: each move of a side fills at most one square (two when it
+// castles) and each move of the other side takes at most one of its
+// pieces. Positions already searched with as many plies left, by Zobrist
+// key, are not searched again, so transpositions cost nothing.
+// Occupancy doesn't tell pieces apart, so lines of the same length can
+// end in different positions (a promotion, two pieces swapping roles);
+// that is reported rather than one of them guessed.
+class TLineReconstructor {
+  public:
+    TLineReconstructor();
+    // Line of at most plies moves from board to target into line, ended
+    // by 0 (line holds reconstruct_max_plies+1 moves); board is restored.
+    // Up to budget moves are made.
+    ReconstructResult Search(board_t *board, const TFindPos &target, int plies, int budget, mv_t line[]);
+    int Nodes;                   // Moves made by the last search
+  private:
+    struct Searched {
+        uint64 key;
+        int plies;               // Plies left when searched; 0 for a free slot
+    };
+    std::vector<Searched> Table;
+    ReconstructResult SearchPlies(board_t *board, int ply, int plies);
+    bool Visit(uint64 key, int plies);
+    const TFindPos *Target;
+    int Budget;
+    mv_t Path[reconstruct_max_plies+1];
+    mv_t *Line;
+    bool Found;
+    uint64 FoundKey;             // Position the line found ends in
+};
+
+const int reconstruct_memo_bits = 9;        // Memo of 1<<bits buckets of two entries
+
+// Outcomes of the searches from positions to recognized occupancies, so
+// that a pair seen again (an idle board, a frame read twice, a change no
+// line explains) costs one probe. Keyed by the board's Zobrist key and
+// the two occupancy words; a bucket is one cache line. Lines of more
+// than memo_moves plies aren't kept: the state moves on past them.
+const int memo_moves = 2;
+
+class TReconstructMemo {
+  public:
+    TReconstructMemo();
+    // Forget every outcome, as a new game does
+    void Clear();
+    // Outcome stored for board and target, with its line into pv (which
+    // holds memo_moves+1 moves)
+    bool Probe(const board_t *board, const TFindPos &target, ReconstructResult &result, mv_t pv[]) const;
+    // Keeps an outcome found for a pair the memo didn't have
+    void Store(const board_t *board, const TFindPos &target, ReconstructResult result, const mv_t pv[]);
+  private:
+    struct Entry {
+        uint64 key;
+        uint64 occupancy[ColourNb];
+        mv_t pv[memo_moves];
+        unsigned char result;    // ReconstructResult
+        bool stored;
+        char pad[2];
+    };
+    // Newest entry first
+    struct alignas(64) Bucket {
+        Entry entry[2];
+    };
+    static_assert(sizeof(Bucket) == 64, "a memo bucket is one cache line");
+    // The buckets live in Storage at the first line boundary: operator new
+    // before C++17 doesn't align a TEngine holding them to one
+    std::vector<char> Storage;
+    Bucket *Buckets;
+    TReconstructMemo(const TReconstructMemo &);
+    TReconstructMemo &operator=(const TReconstructMemo &);
+};
+
+#endif
@@ -0,0 +1,179 @@
+//---------------------------------------------------------------------------
+#include "MultiBoard.h"
+
+//---------------------------------------------------------------------------
+
+static int OverlapArea(const BoardRect &a, const BoardRect &b)
+{
+  int x0 = a.x > b.x ? a.x : b.x;
+  int y0 = a.y > b.y ? a.y : b.y;
+  int x1 = a.x + a.size < b.x + b.size ? a.x + a.size : b.x + b.size;
+  int y1 = a.y + a.size < b.y + b.size ? a.y + a.size : b.y + b.size;
+  if (x1 <= x0 || y1 <= y0)
+    return 0;
+  return (x1 - x0) * (y1 - y0);
+}
+
+TMultiBoardCapture::TMultiBoardCapture()
+{
+  ProgramType = 0;
+  ScanInterval = 10;
+  MaxMisses = 5;
+  NextId = 1;
+  CaptureCount = 0;
+  Pool = &TWorkerPool::Shared();
+}
+
+TMultiBoardCapture::~TMultiBoardCapture()
+{
+  Clear();
+}
+
+void TMultiBoardCapture::SetProgramType(int type)
+{
+  ProgramType = type;
+  Scanner.ProgramType = type;
+  Scanner.LoadDetectionConfig();
+}
+
+void TMultiBoardCapture::SetFrameSource(TFrameSource *source)
+{
+  Scanner.SetFrameSource(source);
+  CaptureCount = 0;
+}
+
+void TMultiBoardCapture::Clear()
+{
+  while (!Boards.empty())
+    RemoveBoard(Boards.size() - 1);
+}
+
+void TMultiBoardCapture::RemoveBoard(size_t i)
+{
+  ReleaseRecognizer(Boards[i].Id, Boards[i].Recognize);
+  delete Boards[i].View;
+  Boards.erase(Boards.begin() + i);
+}
+
+TTrackedBoard *TMultiBoardCapture::FindBoard(int id)
+{
+  for (size_t i = 0; i < Boards.size(); i++)
+    if (Boards[i].Id == id)
+      return &Boards[i];
+  return NULL;
+}
+
+bool TMultiBoardCapture::Capture()
+{
+  // Boards whose own tracker lost them since the last capture; a full
+  // scan counts the misses itself, so that each capture counts one
+  bool scan = Boards.empty() || CaptureCount % ScanInterval == 0;
+  for (size_t i = 0; i < Boards.size(); i++) {
+    TBoardCapture &capture = Boards[i].Recognize->BoardCapture;
+    if (capture.Captured) {
+      Boards[i].Misses = 0;
+      Boards[i].Rect = capture.GetBoardRect();
+    }
+    else if (!scan)
+      Boards[i].Misses++;
+  }
+
+  if (!Scanner.CaptureScreen())
+    return false;
+  Scanner.GetFrame(Frame);
+  for (size_t i = 0; i < Boards.size(); i++)
+    Boards[i].View->SetFrame(Frame);
+
+  // Between full scans every board is followed by its own tracker
+  if (scan) {
+    Scanner.LocateBoards(Found);
+    MatchBoards();
+  }
+  CaptureCount++;
+
+  for (size_t i = 0; i < Boards.size(); ) {
+    if (Boards[i].Misses > MaxMisses)
+      RemoveBoard(i);
+    else
+      i++;
+  }
+  return true;
+}
+
+void TMultiBoardCapture::MatchBoards()
+{
+  std::vector<bool> matched(Boards.size(), false);
+  for (size_t f = 0; f < Found.size(); f++) {
+    int best = -1;
+    int best_area = 0;
+    for (size_t i = 0; i < Boards.size(); i++) {
+      if (matched[i])
+        continue;
+      int area = OverlapArea(Found[f], Boards[i].Rect);
+      int smaller = Found[f].size < Boards[i].Rect.size ? Found[f].size : Boards[i].Rect.size;
+      // Same board if they share at least half of the smaller one
+      if (2 * area >= smaller * smaller && area > best_area) {
+        best = (int)i;
+        best_area = area;
+      }
+    }
+    if (best < 0) {
+      AddBoard(Found[f]);
+      matched.push_back(true);
+      continue;
+    }
+    matched[best] = true;
+    TTrackedBoard &board = Boards[best];
+    board.Misses = 0;
+    if (board.Rect.x != Found[f].x || board.Rect.y != Found[f].y || board.Rect.size != Found[f].size) {
+      board.Rect = Found[f];
+      board.Recognize->BoardCapture.TrackBoard(Found[f]);
+      board.Recognize->InvalidateTiles();
+    }
+  }
+  for (size_t i = 0; i < matched.size(); i++)
+    if (!matched[i])
+      Boards[i].Misses++;
+}
+
+void TMultiBoardCapture::AddBoard(const BoardRect &rect)
+{
+  TTrackedBoard board;
+  board.Id = NextId++;
+  board.Rect = rect;
+  board.Misses = 0;
+  board.Recognize = CreateRecognizer(board.Id);
+  board.Recognize->ProgramType = ProgramType;
+  board.Recognize->Pool = Pool;
+  board.View = new TFrameViewSource();
+  board.View->SetFrame(Frame);
+  TBoardCapture &capture = board.Recognize->BoardCapture;
+  capture.ProgramType = ProgramType;
+  capture.LoadDetectionConfig();
+  capture.SetFrameSource(board.View);
+  capture.TrackOnly = true;
+  capture.TrackBoard(rect);
+  Boards.push_back(board);
+}
+
+void TMultiBoardCapture::Recognize()
+{
+  // Boards share nothing but the frame they read; a board's own squares
+  // stay on the worker that has it
+  std::function<void(int)> recognize = [this](int i) { Boards[i].Recognize->Recognize(); };
+  if (Pool)
+    Pool->Run((int)Boards.size(), recognize);
+  else
+    for (size_t i = 0; i < Boards.size(); i++)
+      recognize((int)i);
+}
+
+TBoardRecognize *TMultiBoardCapture::CreateRecognizer(int /*id*/)
+{
+  return new TBoardRecognize();
+}
+
+void TMultiBoardCapture::ReleaseRecognizer(int /*id*/, TBoardRecognize *recognize)
+{
+  delete recognize;
+}
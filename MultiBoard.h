@@ -0,0 +1,56 @@
+//---------------------------------------------------------------------------
+
+#ifndef MultiBoardH
+#define MultiBoardH
+
+#include <vector>
+#include "FrameSource.h"
+#include "TBoardCapture.h"
+#include "TBoardRecognize.h"
+#include "WorkerPool.h"
+//---------------------------------------------------------------------------
+// Tracks every board on screen from one shared capture. The screen is
+// grabbed and border-scanned once; each board gets a stable id and its own
+// recognizer, which reads its rectangle out of the shared frame through a
+// view of its own, so the boards can be recognized on several threads.
+//---------------------------------------------------------------------------
+
+struct TTrackedBoard {
+    int Id;
+    BoardRect Rect;
+    int Misses;                  // Captures in a row the board was not seen
+    TBoardRecognize *Recognize;
+    TFrameViewSource *View;
+};
+
+class TMultiBoardCapture {
+  public:
+    TMultiBoardCapture();
+    virtual ~TMultiBoardCapture();
+    int ProgramType;
+    int ScanInterval;            // Full border scan every N captures
+    int MaxMisses;               // Drop a board after this many misses
+    TWorkerPool *Pool;           // Recognizes the boards in parallel; NULL in turn
+    void SetProgramType(int type);
+    void SetFrameSource(TFrameSource *source);
+    bool Capture();
+    void Recognize();
+    void Clear();
+    TTrackedBoard *FindBoard(int id);
+    std::vector<TTrackedBoard> Boards;
+  protected:
+    // Pipeline hooks: the default owns a plain TBoardRecognize per board
+    virtual TBoardRecognize *CreateRecognizer(int id);
+    virtual void ReleaseRecognizer(int id, TBoardRecognize *recognize);
+  private:
+    TBoardCapture Scanner;
+    CapturedFrame Frame;
+    std::vector<BoardRect> Found;
+    int NextId;
+    int CaptureCount;
+    void MatchBoards();
+    void AddBoard(const BoardRect &rect);
+    void RemoveBoard(size_t i);
+};
+
+#endif
@@ -0,0 +1,429 @@
+//---------------------------------------------------------------------------
+#include <cmath>
+#include <cstdio>
+#include "PieceTemplates.h"
+#include "ColorClassTable.h"
+#include "piece.h"
+#include "square.h"
+
+//---------------------------------------------------------------------------
+
+// Weight of the "is foreground" component against the colour components
+const float template_presence = 128.0f;
+
+// First word of a template cache file, "ICKT"
+const int template_file_magic = 0x544B4349;
+
+BoardPieces::BoardPieces()
+{
+  Clear();
+}
+
+void BoardPieces::Clear()
+{
+  for (int i=0; i<64; i++) {
+    square[i] = PieceUnknown12;
+    score[i] = 0;
+    for (int p=0; p<12; p++)
+      match[i][p] = 0;
+  }
+  complete = false;
+}
+
+void BoardPieces::UpdateComplete()
+{
+  complete = true;
+  for (int i=0; i<64; i++)
+    if (square[i] == PieceUnknown12)
+      complete = false;
+}
+
+int BoardPieces::BoardSquare(int sq, bool reversed)
+{
+  // Same numbering as SQUARE_OCCUPANCY and TFindPos::Reverse
+  int k = reversed ? 63 - sq : sq;
+  return SQUARE_MAKE(FileA + 7 - (k&7), Rank1 + (k>>3));
+}
+
+int BoardPieces::ScreenSquare(int sq, bool reversed)
+{
+  int k = (SQUARE_RANK(sq) - Rank1)*8 + 7 - (SQUARE_FILE(sq) - FileA);
+  return reversed ? 63 - k : k;
+}
+
+// Whether colour attacks sq, from board->square alone (the piece lists
+// are not built yet when a recognized position is checked)
+static bool SquareAttacked(const board_t *board, int sq, int colour)
+{
+  static const int knight[8] = { -33, -31, -18, -14, 14, 18, 31, 33 };
+  static const int king[8] = { -17, -16, -15, -1, 1, 15, 16, 17 };
+  int forward = COLOUR_IS_WHITE(colour) ? 16 : -16;
+  int pawn = PAWN_MAKE(colour);
+  if (board->square[sq-forward-1] == pawn || board->square[sq-forward+1] == pawn)
+    return true;
+  for (int i=0; i<8; i++) {
+    int piece = board->square[sq+knight[i]];
+    if (piece != Edge && piece != Empty && COLOUR_IS(piece,colour) && PIECE_IS_KNIGHT(piece))
+      return true;
+    piece = board->square[sq+king[i]];
+    if (piece != Edge && piece != Empty && COLOUR_IS(piece,colour) && PIECE_IS_KING(piece))
+      return true;
+    // Slide until the first piece; diagonals need a bishop or queen,
+    // lines a rook or queen
+    bool diagonal = (king[i] & 1) && king[i] != 1 && king[i] != -1;
+    int to = sq + king[i];
+    while (board->square[to] == Empty)
+      to += king[i];
+    piece = board->square[to];
+    if (piece == Edge || !COLOUR_IS(piece,colour))
+      continue;
+    if (diagonal ? (piece & BishopFlag) != 0 : (piece & RookFlag) != 0)
+      return true;
+  }
+  return false;
+}
+
+// Whether every piece on colour's back rank stands on its start square
+static bool BackRankAtHome(const board_t *board, int colour)
+{
+  static const int white[8] = { WR, WN, WB, WQ, WK, WB, WN, WR };
+  static const int black[8] = { BR, BN, BB, BQ, BK, BB, BN, BR };
+  int rank = COLOUR_IS_WHITE(colour) ? Rank1 : Rank8;
+  for (int file=0; file<8; file++) {
+    int piece = board->square[SQUARE_MAKE(FileA+file,rank)];
+    if (piece != Empty && piece != (COLOUR_IS_WHITE(colour) ? white[file] : black[file]))
+      return false;
+  }
+  return true;
+}
+
+bool BoardPieces::ToBoard(board_t *board, bool reversed, int turn) const
+{
+  if (!complete)
+    return false;
+  int kings[ColourNb] = { 0, 0 };
+  int pawns[ColourNb] = { 0, 0 };
+  int pieces[ColourNb] = { 0, 0 };
+  board_clear(board);
+  for (int i=0; i<64; i++) {
+    if (square[i] == PieceNone12)
+      continue;
+    int piece = PieceFrom12[square[i]];
+    int sq = BoardSquare(i, reversed);
+    int colour = PIECE_COLOUR(piece);
+    pieces[colour]++;
+    if (PIECE_IS_KING(piece))
+      kings[colour]++;
+    if (PIECE_IS_PAWN(piece)) {
+      pawns[colour]++;
+      if (SQUARE_RANK(sq) == Rank1 || SQUARE_RANK(sq) == Rank8)
+        return false;
+    }
+    board->square[sq] = piece;
+  }
+  for (int colour=0; colour<ColourNb; colour++)
+    if (kings[colour] != 1 || pawns[colour] > 8 || pieces[colour] > 16)
+      return false;
+
+  // The side that just moved can't be left in check
+  for (int sq=0; sq<SquareNb; sq++) {
+    int piece = board->square[sq];
+    if (piece != Edge && piece != Empty && PIECE_IS_KING(piece) &&
+        COLOUR_IS(piece,COLOUR_OPP(turn)) && SquareAttacked(board,sq,turn))
+      return false;
+  }
+
+  board->turn = turn;
+  // One frame can't show that king or rook never moved, so castling is
+  // only granted where that back rank looks untouched: king and rook at
+  // home and nothing on the rank but pieces on their start squares. A
+  // right wrongly kept would have the engine play an illegal castling; a
+  // right wrongly dropped only hides a move
+  bool white = board->square[E1] == WK && BackRankAtHome(board,White);
+  bool black = board->square[E8] == BK && BackRankAtHome(board,Black);
+  if (white && board->square[H1] == WR) board->flags |= FlagsWhiteKingCastle;
+  if (white && board->square[A1] == WR) board->flags |= FlagsWhiteQueenCastle;
+  if (black && board->square[H8] == BR) board->flags |= FlagsBlackKingCastle;
+  if (black && board->square[A8] == BR) board->flags |= FlagsBlackQueenCastle;
+  board_init_list(board);
+  return true;
+}
+
+bool BoardPieces::Matches(const board_t *board, bool reversed) const
+{
+  for (int i=0; i<64; i++) {
+    int piece = board->square[BoardSquare(i, reversed)];
+    if (square[i] == PieceNone12) {
+      if (piece != Empty)
+        return false;
+    } else if (square[i] < 0 || piece != PieceFrom12[square[i]]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void BoardPieces::FromBoard(const board_t *board, bool reversed)
+{
+  for (int i=0; i<64; i++) {
+    int piece = board->square[BoardSquare(i, reversed)];
+    square[i] = piece == Empty ? PieceNone12 : PIECE_TO_12(piece);
+    score[i] = 1;
+    for (int p=0; p<12; p++)
+      match[i][p] = p == square[i] ? 1.0f : 0.0f;
+  }
+  complete = true;
+}
+
+//---------------------------------------------------------------------------
+
+void TPieceTemplates::Exemplar::Add(const std::vector<float> &feature)
+{
+  if (sum.empty())
+    sum.assign(feature.size(), 0.0f);
+  for (size_t i=0; i<sum.size(); i++)
+    sum[i] += feature[i];
+  count++;
+  Update();
+}
+
+void TPieceTemplates::Exemplar::Update()
+{
+  double norm = 0;
+  for (size_t i=0; i<sum.size(); i++)
+    norm += (double)sum[i]*sum[i];
+  float scale = norm > 0 ? (float)(1.0/sqrt(norm)) : 0.0f;
+  unit.resize(sum.size());
+  for (size_t i=0; i<sum.size(); i++)
+    unit[i] = sum[i]*scale;
+}
+
+TPieceTemplates::TPieceTemplates()
+{
+  Clear();
+}
+
+void TPieceTemplates::Clear()
+{
+  for (int c=0; c<2; c++) {
+    BackgroundSum[c].assign(template_samples*template_samples*3, 0);
+    Background[c].assign(template_samples*template_samples*3, 0);
+    BackgroundCount[c] = 0;
+  }
+  for (int p=0; p<12; p++)
+    Pieces[p] = Exemplar();
+}
+
+bool TPieceTemplates::Ready() const
+{
+  if (!BackgroundCount[0] || !BackgroundCount[1])
+    return false;
+  for (int p=0; p<12; p++)
+    if (!Pieces[p].count)
+      return false;
+  return true;
+}
+
+double TPieceTemplates::Measure(const int *start, int size, int stride, const int *background) const
+{
+  // A template_samples grid of cells, kept off the square's edges
+  int inset = size/16;
+  int span = size - 2*inset;
+  const int limit = square_color_tolerance*square_color_tolerance;
+  int cells = template_samples*template_samples;
+  Samples.resize(cells*3);
+  Feature.assign(template_features, 0.0f);
+  int foreground = 0;
+  int pixels = 0;
+  for (int cy=0; cy<template_samples; cy++) {
+    int y0 = inset + cy*span/template_samples;
+    int y1 = inset + (cy + 1)*span/template_samples;
+    for (int cx=0; cx<template_samples; cx++) {
+      int x0 = inset + cx*span/template_samples;
+      int x1 = inset + (cx + 1)*span/template_samples;
+      int k = cy*template_samples + cx;
+      int sum[3] = { 0, 0, 0 };
+      int fg[3] = { 0, 0, 0 };
+      int fg_count = 0;
+      for (int y=y0; y<y1; y++) {
+        const int *row = start + y*stride;
+        for (int x=x0; x<x1; x++) {
+          int r = (row[x]>>16) & 255;
+          int g = (row[x]>>8) & 255;
+          int b = row[x] & 255;
+          sum[0] += r;
+          sum[1] += g;
+          sum[2] += b;
+          if (!background)
+            continue;
+          int dr = r - background[3*k];
+          int dg = g - background[3*k+1];
+          int db = b - background[3*k+2];
+          if (dr*dr + dg*dg + db*db > limit) {
+            fg[0] += r;
+            fg[1] += g;
+            fg[2] += b;
+            fg_count++;
+          }
+        }
+      }
+      int n = (x1 - x0)*(y1 - y0);
+      if (n <= 0)
+        n = 1;
+      for (int c=0; c<3; c++)
+        Samples[3*k+c] = sum[c]/n;
+      foreground += fg_count;
+      pixels += n;
+      if (fg_count) {
+        // Presence and mean foreground colour, weighted by the share of
+        // the cell the piece covers
+        float share = (float)fg_count/n;
+        float *out = &Feature[4*k];
+        out[0] = share*template_presence;
+        for (int c=0; c<3; c++)
+          out[c+1] = share*((float)fg[c]/fg_count - 128.0f);
+      }
+    }
+  }
+  return pixels ? (double)foreground/pixels : 0.0;
+}
+
+void TPieceTemplates::Normalize() const
+{
+  // [1 2 1] blur in both directions so a glyph shifted by a cell still
+  // correlates, then unit length
+  Blurred.assign(template_features, 0.0f);
+  const int n = template_samples;
+  for (int y=0; y<n; y++) {
+    for (int x=0; x<n; x++) {
+      float *out = &Blurred[4*(y*n + x)];
+      for (int dy=-1; dy<=1; dy++) {
+        if (y+dy < 0 || y+dy >= n)
+          continue;
+        for (int dx=-1; dx<=1; dx++) {
+          if (x+dx < 0 || x+dx >= n)
+            continue;
+          float w = (float)((dy ? 1 : 2)*(dx ? 1 : 2));
+          const float *in = &Feature[4*((y+dy)*n + x+dx)];
+          for (int c=0; c<4; c++)
+            out[c] += w*in[c];
+        }
+      }
+    }
+  }
+  double norm = 0;
+  for (int i=0; i<template_features; i++)
+    norm += (double)Blurred[i]*Blurred[i];
+  float scale = norm > 0 ? (float)(1.0/sqrt(norm)) : 0.0f;
+  for (int i=0; i<template_features; i++)
+    Feature[i] = Blurred[i]*scale;
+}
+
+void TPieceTemplates::Learn(const int *start, int size, int stride, bool light, int piece)
+{
+  int c = light ? 1 : 0;
+  if (piece == PieceNone12) {
+    Measure(start, size, stride, NULL);
+    BackgroundCount[c]++;
+    for (size_t i=0; i<Samples.size(); i++) {
+      BackgroundSum[c][i] += Samples[i];
+      Background[c][i] = BackgroundSum[c][i]/BackgroundCount[c];
+    }
+    return;
+  }
+  if (piece < 0 || piece >= 12 || !BackgroundCount[c])
+    return;
+  if (Measure(start, size, stride, &Background[c][0]) < template_min_piece)
+    return;
+  Normalize();
+  Pieces[piece].Add(Feature);
+}
+
+int TPieceTemplates::Match(const int *start, int size, int stride, bool light, float *score,
+                           float *scores) const
+{
+  int c = light ? 1 : 0;
+  *score = 0;
+  if (scores)
+    for (int p=0; p<12; p++)
+      scores[p] = 0;
+  if (!BackgroundCount[c])
+    return PieceUnknown12;
+  if (Measure(start, size, stride, &Background[c][0]) < template_min_piece) {
+    *score = 1;
+    return PieceNone12;
+  }
+  Normalize();
+  int best = PieceUnknown12;
+  float best_score = -1;
+  for (int p=0; p<12; p++) {
+    if (!Pieces[p].count)
+      continue;
+    const float *unit = &Pieces[p].unit[0];
+    const float *feature = &Feature[0];
+    float dot = 0;
+    for (int i=0; i<template_features; i++)
+      dot += unit[i]*feature[i];
+    if (scores)
+      scores[p] = dot > 0 ? dot : 0;
+    if (dot > best_score) {
+      best_score = dot;
+      best = p;
+    }
+  }
+  *score = best_score > 0 ? best_score : 0;
+  if (best_score < template_min_score)
+    return PieceUnknown12;
+  return best;
+}
+
+bool TPieceTemplates::Save(const char *FileName) const
+{
+  FILE *f = fopen(FileName, "wb");
+  if (!f)
+    return false;
+  const int header[3] = { template_file_magic, template_samples, template_features };
+  bool ok = fwrite(header, sizeof(header), 1, f) == 1;
+  for (int c=0; c<2 && ok; c++)
+    ok = fwrite(&BackgroundCount[c], sizeof(int), 1, f) == 1 &&
+         fwrite(&BackgroundSum[c][0], sizeof(int), BackgroundSum[c].size(), f) == BackgroundSum[c].size();
+  for (int p=0; p<12 && ok; p++) {
+    ok = fwrite(&Pieces[p].count, sizeof(int), 1, f) == 1;
+    if (ok && Pieces[p].count)
+      ok = fwrite(&Pieces[p].sum[0], sizeof(float), template_features, f) == (size_t)template_features;
+  }
+  if (fclose(f) != 0)
+    ok = false;
+  if (!ok)
+    remove(FileName);
+  return ok;
+}
+
+bool TPieceTemplates::Load(const char *FileName)
+{
+  Clear();
+  FILE *f = fopen(FileName, "rb");
+  if (!f)
+    return false;
+  int header[3];
+  bool ok = fread(header, sizeof(header), 1, f) == 1 && header[0] == template_file_magic &&
+            header[1] == template_samples && header[2] == template_features;
+  for (int c=0; c<2 && ok; c++) {
+    ok = fread(&BackgroundCount[c], sizeof(int), 1, f) == 1 && BackgroundCount[c] >= 0 &&
+         fread(&BackgroundSum[c][0], sizeof(int), BackgroundSum[c].size(), f) == BackgroundSum[c].size();
+    for (size_t i=0; ok && BackgroundCount[c] && i<Background[c].size(); i++)
+      Background[c][i] = BackgroundSum[c][i]/BackgroundCount[c];
+  }
+  for (int p=0; p<12 && ok; p++) {
+    ok = fread(&Pieces[p].count, sizeof(int), 1, f) == 1 && Pieces[p].count >= 0;
+    if (ok && Pieces[p].count) {
+      Pieces[p].sum.resize(template_features);
+      ok = fread(&Pieces[p].sum[0], sizeof(float), template_features, f) == (size_t)template_features;
+      Pieces[p].Update();
+    }
+  }
+  fclose(f);
+  if (!ok)
+    Clear();
+  return ok;
+}
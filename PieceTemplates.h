@@ -0,0 +1,94 @@
+//---------------------------------------------------------------------------
+
+#ifndef PieceTemplatesH
+#define PieceTemplatesH
+
+#include <vector>
+#include "board.h"
+//---------------------------------------------------------------------------
+// Piece identity by template matching. A square is reduced to a grid of
+// cells; pixels close to the empty square of the same colour are
+// background and dropped, the rest give each cell's piece coverage and
+// colour. Templates are averaged exemplars of those features per piece,
+// so one exemplar serves light and dark squares alike, and a square is
+// matched by normalized correlation against all twelve.
+//---------------------------------------------------------------------------
+
+const int template_samples = 16;         // Cells per square side
+const int template_features = template_samples*template_samples*4;
+const double template_min_score = 0.80;  // Weaker matches leave the square unknown
+const double template_min_piece = 0.02;  // Foreground share below this is an empty square
+
+// Piece codes are fruit's 12-index (WhitePawn12 .. BlackKing12)
+const int PieceNone12 = -1;              // Empty square
+const int PieceUnknown12 = -2;           // No confident match
+
+// Piece of every square in screen order (square 0 = top-left, like
+// TFindPos), with the correlation each match had and the one it had
+// with every piece's template
+struct BoardPieces {
+    int square[64];
+    float score[64];
+    float match[64][12];
+    bool complete;                       // No square is PieceUnknown12
+
+    BoardPieces();
+    void Clear();
+    void UpdateComplete();
+    // Fruit square of screen square sq: reversed is TEngine::Reversed,
+    // true when a8 is in the top-left corner
+    static int BoardSquare(int sq, bool reversed);
+    // And back: screen square of fruit square sq
+    static int ScreenSquare(int sq, bool reversed);
+    // Pieces as a position with turn to move; false when the squares
+    // are incomplete or no legal position (kings, pawns on the back rank).
+    // Castling is granted only where the back rank is untouched
+    bool ToBoard(board_t *board, bool reversed, int turn) const;
+    // Whether board has exactly these pieces on its squares
+    bool Matches(const board_t *board, bool reversed) const;
+    // The pieces of board, as they appear on screen
+    void FromBoard(const board_t *board, bool reversed);
+};
+
+class TPieceTemplates {
+  public:
+    TPieceTemplates();
+    void Clear();
+    // Empty squares of both colours and all twelve pieces seen
+    bool Ready() const;
+    // Learn from a square whose contents are known; light is the colour
+    // of the square. Empty squares must be learned before pieces.
+    void Learn(const int *start, int size, int stride, bool light, int piece);
+    // Best piece for a square: PieceNone12, a piece, or PieceUnknown12;
+    // scores, when given, gets the correlation with each of the twelve
+    int Match(const int *start, int size, int stride, bool light, float *score,
+              float *scores = NULL) const;
+    // Learned state to and from a cache file; Load leaves the templates
+    // cleared when the file is missing or of another format
+    bool Save(const char *FileName) const;
+    bool Load(const char *FileName);
+  private:
+    struct Exemplar {
+        std::vector<float> sum;          // Sum of the learned features
+        std::vector<float> unit;         // Their mean scaled to unit length
+        int count;
+        Exemplar() : count(0) {}
+        void Add(const std::vector<float> &feature);
+        void Update();
+    };
+    // Mean raw samples (r,g,b) of the empty dark and light squares
+    std::vector<int> BackgroundSum[2];
+    std::vector<int> Background[2];
+    int BackgroundCount[2];
+    Exemplar Pieces[12];
+    mutable std::vector<int> Samples;     // Mean (r,g,b) of every cell
+    mutable std::vector<float> Feature;   // Presence and colour per cell
+    mutable std::vector<float> Blurred;
+    // Fills Samples and, against the background of the square's colour,
+    // Feature; returns the share of foreground pixels
+    double Measure(const int *start, int size, int stride, const int *background) const;
+    // Blurs Feature and scales it to unit length
+    void Normalize() const;
+};
+
+#endif
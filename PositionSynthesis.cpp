@@ -0,0 +1,194 @@
+//---------------------------------------------------------------------------
+#include "PositionSynthesis.h"
+#include <cstring>
+#include "hash.h"
+#include "piece.h"
+#include "square.h"
+
+//---------------------------------------------------------------------------
+
+// Pieces of each kind in the start position; more of one take promotions
+static const int initial_pieces[12] = { 8, 8, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1 };
+
+// State of the search for the pieces of the unknown squares
+struct Synthesis {
+    const BoardPieces *read;     // Template scores of the squares as read
+    BoardPieces pieces;          // Every square, the unknown ones as filled in so far
+    bool reversed;
+    int unknown[synthesis_max_unknown];
+    int colour[synthesis_max_unknown];
+    float rest[synthesis_max_unknown+1]; // Best scores the unknown squares from the u-th on can add
+    int unknowns;
+    int count[12];
+    int turns[ColourNb];         // Sides that can be to move
+    int turnNb;
+    int from, to;                // Fruit squares of the highlighted move, or SquareNone
+    int found;                   // Positions found
+    float best, second;          // Scores of the two best of them
+    board_t *board;              // The best one
+};
+// Whether pieces so counted can be on one board
+static bool CountsPossible(const int count[12])
+{
+  for (int colour=0; colour<ColourNb; colour++) {
+    int pawns = count[WhitePawn12+colour];
+    if (count[WhiteKing12+colour] > 1 || pawns > 8)
+      return false;
+    int promoted = 0;
+    for (int p=WhiteKnight12+colour; p<WhiteKing12; p+=2)
+      if (count[p] > initial_pieces[p])
+        promoted += count[p] - initial_pieces[p];
+    if (promoted > 8 - pawns)
+      return false;
+  }
+  return true;
+}
+
+// En passant is open after a double step of a pawn that an enemy pawn
+// stands next to, as move_do sets it
+static void SetEnPassant(board_t *board, int from, int to)
+{
+  if (from == SquareNone)
+    return;
+  int moved = COLOUR_OPP(board->turn);
+  if (board->square[to] != PAWN_MAKE(moved) || to - from != (COLOUR_IS_WHITE(moved) ? 32 : -32))
+    return;
+  if (board->square[from] != Empty || board->square[(from + to) / 2] != Empty)
+    return;
+  int pawn = PAWN_MAKE(board->turn);
+  if (board->square[to-1] == pawn || board->square[to+1] == pawn) {
+    board->ep_square = (from + to) / 2;
+    board->key = hash_key(board);
+  }
+}
+
+// A position scores the template matches of the pieces put on the
+// unknown squares
+static void Complete(Synthesis &s, float score)
+{
+  for (int t=0; t<s.turnNb; t++) {
+    board_t board;
+    if (!s.pieces.ToBoard(&board,s.reversed,s.turns[t]))
+      continue;
+    s.found++;
+    if (score > s.best) {
+      s.second = s.best;
+      s.best = score;
+      *s.board = board;
+      SetEnPassant(s.board,s.from,s.to);
+    } else if (score > s.second) {
+      s.second = score;
+    }
+  }
+}
+
+// Pieces for the unknown squares from the u-th on; branches that can't
+// score above the second best position can't change the outcome
+static void Assign(Synthesis &s, int u, float score)
+{
+  if (score + s.rest[u] <= s.second)
+    return;
+  if (u == s.unknowns) {
+    Complete(s,score);
+    return;
+  }
+  int i = s.unknown[u];
+  int rank = SQUARE_RANK(BoardPieces::BoardSquare(i,s.reversed));
+  for (int p=WhitePawn12+s.colour[u]; p<12; p+=2) {
+    if (p <= BlackPawn12 && (rank == Rank1 || rank == Rank8))
+      continue;
+    s.count[p]++;
+    if (CountsPossible(s.count)) {
+      s.pieces.square[i] = p;
+      Assign(s,u+1,score + s.read->match[i][p]);
+    }
+    s.count[p]--;
+  }
+}
+
+ReconstructResult SynthesizePosition(const TFindPos &pos, const BoardPieces &pieces, uint64 highlighted,
+                                     bool reversed, int turn, board_t *board)
+{
+  Synthesis s;
+  s.read = &pieces;
+  s.reversed = reversed;
+  s.unknowns = 0;
+  s.found = 0;
+  s.best = s.second = -1;
+  s.board = board;
+  memset(s.count,0,sizeof(s.count));
+  int colours[64];
+  for (int i=0; i<64; i++) {
+    uint64 bit = ((uint64)1)<<i;
+    colours[i] = (pos.find_pos[White] & bit) ? White : (pos.find_pos[Black] & bit) ? Black : ColourNone;
+    if (colours[i] == ColourNone) {
+      s.pieces.square[i] = PieceNone12;
+      continue;
+    }
+    // A piece read is kept where its colour agrees with the square's
+    int piece = pieces.square[i];
+    if (piece >= 0 && (piece & 1) == colours[i]) {
+      s.pieces.square[i] = piece;
+      s.count[piece]++;
+      continue;
+    }
+    if (s.unknowns == synthesis_max_unknown)
+      return RECONSTRUCT_BUDGET;
+    s.unknown[s.unknowns] = i;
+    s.colour[s.unknowns] = colours[i];
+    s.unknowns++;
+  }
+  s.pieces.complete = true;
+  if (!CountsPossible(s.count))
+    return RECONSTRUCT_NONE;
+  s.rest[s.unknowns] = 0;
+  for (int u=s.unknowns-1; u>=0; u--) {
+    float top = 0;
+    for (int p=WhitePawn12+s.colour[u]; p<12; p+=2)
+      if (pieces.match[s.unknown[u]][p] > top)
+        top = pieces.match[s.unknown[u]][p];
+    s.rest[u] = s.rest[u+1] + top;
+  }
+
+  // The highlighted move ended on the square of the two that is taken,
+  // unless both are (castling, on some sites)
+  s.from = s.to = SquareNone;
+  int moved = ColourNone;
+  int squares[2];
+  int marked = 0;
+  for (int i=0; i<64 && marked<=2; i++)
+    if (highlighted & (((uint64)1)<<i)) {
+      if (marked < 2)
+        squares[marked] = i;
+      marked++;
+    }
+  if (marked == 2) {
+    int a = colours[squares[0]], b = colours[squares[1]];
+    if (a != ColourNone && b != ColourNone) {
+      if (a == b)
+        moved = a;
+    } else if (a != ColourNone || b != ColourNone) {
+      int to = a != ColourNone ? squares[0] : squares[1];
+      int from = a != ColourNone ? squares[1] : squares[0];
+      moved = colours[to];
+      s.from = BoardPieces::BoardSquare(from,reversed);
+      s.to = BoardPieces::BoardSquare(to,reversed);
+    }
+  }
+  s.turnNb = 0;
+  if (moved != ColourNone)
+    s.turns[s.turnNb++] = COLOUR_OPP(moved);
+  else if (turn != ColourNone)
+    s.turns[s.turnNb++] = turn;
+  else {
+    s.turns[s.turnNb++] = White;
+    s.turns[s.turnNb++] = Black;
+  }
+
+  Assign(s,0,0);
+  if (s.found == 0)
+    return RECONSTRUCT_NONE;
+  if (s.found == 1 || s.best - s.second >= synthesis_min_margin)
+    return RECONSTRUCT_FOUND;
+  return RECONSTRUCT_AMBIGUOUS;
+}
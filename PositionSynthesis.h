@@ -0,0 +1,36 @@
+//---------------------------------------------------------------------------
+
+#ifndef PositionSynthesisH
+#define PositionSynthesisH
+
+#include "board.h"
+#include "find_pos.h"
+#include "PieceTemplates.h"
+#include "MoveReconstruct.h"
+//---------------------------------------------------------------------------
+// A position put together from one frame, for joining a game that was
+// already under way. The colours of the squares are taken as read; each
+// square whose piece the templates know keeps it, and the others get
+// every piece of their colour that still leaves a legal position: one
+// king a side, no pawn on its first or last rank, no more promoted
+// pieces than pawns gone, the side that moved not in check. The side to
+// move is the one that didn't make the highlighted move, else the one
+// given; without either, whichever side the check rule allows. Castling
+// is granted conservatively, as BoardPieces::ToBoard does, and en passant
+// only after a highlighted double step. Of the legal positions, the one
+// whose unknown squares match their pieces' templates best is given when
+// it leads the next by synthesis_min_margin; positions differing only in
+// the side to move tie.
+//---------------------------------------------------------------------------
+
+const int synthesis_max_unknown = 4;     // Occupied squares of unknown piece searched at most
+const float synthesis_min_margin = 0.05f; // Template score the best position must lead by
+
+// Position shown by pos (the squares of each colour, in screen order) and
+// pieces, on a board oriented as reversed is (TEngine::Reversed);
+// highlighted are the screen squares of the last move, or 0, and turn
+// the side to move when known otherwise, or ColourNone
+ReconstructResult SynthesizePosition(const TFindPos &pos, const BoardPieces &pieces, uint64 highlighted,
+                                     bool reversed, int turn, board_t *board);
+
+#endif
@@ -0,0 +1,324 @@
+//---------------------------------------------------------------------------
+
+#ifndef SitePoliciesH
+#define SitePoliciesH
+
+#include <cmath>
+#include <memory>
+#include "DetectionConfig.h"
+#include "ColorClassTable.h"
+//---------------------------------------------------------------------------
+// Per-site pixel classifiers. A policy answers Border, White, Black and
+// Mark for one screen pixel (0x00RRGGBB), and BorderRow and PieceRow for
+// a whole row through the batched kernels where it can. The scan loops of TBoardCapture
+// and TBoardRecognize are templates over the policy: the site is resolved
+// once, when it is configured, and the predicates inline into the loops.
+// Each site's predicates are also baked into a TColorClassTable; the
+// policies whose tests cost more than a load read that table instead.
+//---------------------------------------------------------------------------
+
+const int chessbase = 0;
+const int chessassistant = 1;
+const int bereg = 2;
+const int instantchess = 3;
+const int kurnik = 4;
+const int winboard = 5;
+const int chessgate = 6;
+const int spinchat = 7;
+const int chessclub_dasher = 8;
+const int chesscom = 9;
+const int lichess = 10;
+
+// Smallest brightness step between a square and a measured piece colour
+// that calibrates the cutoffs
+const int piece_min_contrast = 16;
+
+// Values the configurable policies read from SiteDetectionConfig,
+// precomputed so the per-pixel tests are integer only
+struct SitePolicyParams {
+    int programType;
+    int borderColor;
+    bool borderExact;
+    int borderLimit;             // Largest squared RGB distance still border
+    bool piecesCalibrated;       // Compare brightness against the squares
+    int whiteAbove;              // Calibrated: white if max channel > this
+    int blackBelow;              // Calibrated: black if max channel < this
+    int whiteThreshold;          // Uncalibrated per-channel thresholds
+    int blackThreshold;
+    bool squaresCalibrated;
+    int lightSquare, darkSquare; // Calibrated square colours, PackColor order
+
+    SitePolicyParams() : programType(chessbase), borderColor(0), borderExact(true), borderLimit(-1),
+                         piecesCalibrated(false), whiteAbove(255), blackBelow(0),
+                         whiteThreshold(255), blackThreshold(0),
+                         squaresCalibrated(false), lightSquare(0), darkSquare(0) {}
+
+    void Setup(int site, const SiteDetectionConfig &config) {
+        programType = site;
+        borderColor = config.border.color & 0xFFFFFF;
+        borderExact = config.border.useExactMatch;
+        // Same decision as ColorDistance() <= colorThreshold
+        double threshold = config.border.colorThreshold;
+        borderLimit = -1;
+        if (threshold >= 0) {
+            borderLimit = threshold*threshold > 3*255*255 ? 3*255*255 : (int)(threshold*threshold);
+            while (borderLimit < 3*255*255 && sqrt((double)(borderLimit + 1)) <= threshold)
+                borderLimit++;
+            while (borderLimit >= 0 && sqrt((double)borderLimit) > threshold)
+                borderLimit--;
+        }
+
+        piecesCalibrated = config.piece.useAdaptive && config.colorsCalibrated;
+        whiteThreshold = config.piece.whiteThreshold;
+        blackThreshold = config.piece.blackThreshold;
+        // HSV value is the largest channel / 255, so the brightness tests
+        // reduce to cutoffs on the largest channel
+        double lightV = RGBtoHSV(config.lightSquareColor).v;
+        double darkV = RGBtoHSV(config.darkSquareColor).v;
+        whiteAbove = 255;
+        while (whiteAbove >= 0 && whiteAbove/255.0 > lightV + 0.15)
+            whiteAbove--;
+        blackBelow = 0;
+        while (blackBelow < 256 && blackBelow/255.0 < darkV - 0.2)
+            blackBelow++;
+        // Measured piece colours that stand out from their squares put the
+        // cutoffs halfway between the two instead
+        int light = (int)(lightV*255 + 0.5), dark = (int)(darkV*255 + 0.5);
+        if (config.whiteMeasured) {
+            int white = (int)(RGBtoHSV(config.whitePieceColor).v*255 + 0.5);
+            if (white - light >= piece_min_contrast)
+                whiteAbove = (white + light)/2;
+        }
+        if (config.blackMeasured) {
+            int black = (int)(RGBtoHSV(config.blackPieceColor).v*255 + 0.5);
+            if (dark - black >= piece_min_contrast)
+                blackBelow = (black + dark + 1)/2;
+        }
+
+        squaresCalibrated = config.colorsCalibrated;
+        lightSquare = squaresCalibrated ? PackColor(config.lightSquareColor) : 0;
+        darkSquare = squaresCalibrated ? PackColor(config.darkSquareColor) : 0;
+        table.reset();
+    }
+
+    // Colour class table of these settings, fetched on first use
+    const TColorClassTable &Table() const {
+        if (!table)
+            table = TColorClassTable::Get(*this);
+        return *table;
+    }
+
+  private:
+    mutable std::shared_ptr<const TColorClassTable> table;
+};
+
+inline bool ChannelsAbove(int color, int threshold) {
+    return (color & 255) > threshold && ((color>>8) & 255) > threshold &&
+           ((color>>16) & 255) > threshold;
+}
+
+inline bool ChannelsBelow(int color, int threshold) {
+    return (color & 255) < threshold && ((color>>8) & 255) < threshold &&
+           ((color>>16) & 255) < threshold;
+}
+
+inline int MaxChannel(int color) {
+    int r = (color>>16) & 255;
+    int g = (color>>8) & 255;
+    int b = color & 255;
+    int m = r > g ? r : g;
+    return m > b ? m : b;
+}
+
+// BorderRow for policies that only have a per-pixel Border test
+template<class Site>
+struct PixelBorderRow {
+    void BorderRow(const int *row, int count, unsigned char *mask) const {
+        const Site &site = *static_cast<const Site*>(this);
+        for (int i=0; i<count; i++)
+            mask[i] = site.Border(row[i]);
+    }
+};
+
+// Piece colours given by fixed per-channel thresholds
+template<int WhiteMin, int BlackMax>
+struct FixedPieces {
+    bool White(int color) const { return ChannelsAbove(color, WhiteMin); }
+    bool Black(int color) const { return ChannelsBelow(color, BlackMax); }
+    bool Mark(int /*color*/) const { return false; }
+    // PIECE_MASK_WHITE / PIECE_MASK_BLACK of a whole row
+    void PieceRow(const int *row, int count, unsigned char *mask) const {
+        PieceMaskRow(row, count, WhiteMin, BlackMax, mask);
+    }
+};
+
+// Border colour from detection.ini, exact or within a colour distance
+struct ConfigBorder {
+    int color;
+    int limit;
+    bool exact;
+
+    explicit ConfigBorder(const SitePolicyParams &params)
+        : color(params.borderColor), limit(params.borderLimit), exact(params.borderExact) {}
+
+    bool Border(int pixel) const {
+        pixel &= 0xFFFFFF;
+        if (exact)
+            return pixel == color;
+        int dr = ((pixel>>16) & 255) - ((color>>16) & 255);
+        int dg = ((pixel>>8) & 255) - ((color>>8) & 255);
+        int db = (pixel & 255) - (color & 255);
+        return dr*dr + dg*dg + db*db <= limit;
+    }
+
+    // Border mask of a whole row through the batched distance kernels;
+    // an exact match is a distance of zero
+    void BorderRow(const int *row, int count, unsigned char *mask) const {
+        int distance2[256];
+        for (int i=0; i<count; i+=256) {
+            int n = count - i < 256 ? count - i : 256;
+            ColorDistanceRow(row + i, n, color, distance2);
+            ThresholdMaskRow(distance2, n, exact ? 0 : limit, mask + i);
+        }
+    }
+};
+
+struct ChessbasePolicy : FixedPieces<190,100>, PixelBorderRow<ChessbasePolicy> {
+    explicit ChessbasePolicy(const SitePolicyParams &) {}
+    bool Border(int color) const { return color == 0; }
+};
+
+struct ChessassistantPolicy : FixedPieces<220,50>, PixelBorderRow<ChessassistantPolicy> {
+    explicit ChessassistantPolicy(const SitePolicyParams &) {}
+    bool Border(int color) const {
+        return color == ((113<<16) + (111<<8) + 100) || color == ((133<<16) + (135<<8) + 140) ||
+               color == ((64<<16) + (64<<8) + 64);
+    }
+};
+
+struct BeregPolicy : FixedPieces<240,50>, PixelBorderRow<BeregPolicy> {
+    explicit BeregPolicy(const SitePolicyParams &) {}
+    bool Border(int color) const { return color == 0 || color == ((64<<16) + (64<<8) + 64); }
+};
+
+struct InstantchessPolicy : FixedPieces<250,50>, PixelBorderRow<InstantchessPolicy> {
+    explicit InstantchessPolicy(const SitePolicyParams &) {}
+    bool Border(int color) const { return (color & 0xFFFFFF) == 0; }
+    bool Mark(int color) const { return (color & 0xFFFFFF) == ((0<<16) + (102<<8) + 153); }
+};
+
+struct KurnikPolicy : FixedPieces<250,50>, PixelBorderRow<KurnikPolicy> {
+    explicit KurnikPolicy(const SitePolicyParams &) {}
+    bool Border(int color) const { return (color & 0xFFFFFF) == 0; }
+};
+
+struct WinboardPolicy : FixedPieces<190,50>, PixelBorderRow<WinboardPolicy> {
+    explicit WinboardPolicy(const SitePolicyParams &) {}
+    bool Border(int color) const { return color == 0 || color == ((255<<16) + (255<<8)); }
+};
+
+struct ChessgatePolicy : ConfigBorder, FixedPieces<254,50> {
+    explicit ChessgatePolicy(const SitePolicyParams &params) : ConfigBorder(params) {}
+};
+
+struct SpinchatPolicy : FixedPieces<190,50>, PixelBorderRow<SpinchatPolicy> {
+    explicit SpinchatPolicy(const SitePolicyParams &) {}
+    bool Border(int color) const {
+        color &= 0xFFFFFF;
+        return color == (255<<16) + (234<<8) + 157 || color == (164<<16) + (110<<8) + 48 ||
+               color == (80<<16) + (53<<8) + 23 || color == (140<<16) + (114<<8) + 77 ||
+               color == (178<<8) || color == (178<<16);
+    }
+};
+
+struct ChessclubDasherPolicy : FixedPieces<220,50>, PixelBorderRow<ChessclubDasherPolicy> {
+    explicit ChessclubDasherPolicy(const SitePolicyParams &) {}
+    bool Border(int color) const {
+        int r = (color >> 16) & 255;
+        int g = (color >> 8) & 255;
+        int b = color & 255;
+        return (r > 55 && r < 60) && (g > 33 && g < 39) && (b > 17 && b < 23);
+    }
+};
+
+// Sites without hand-tuned colours (chess.com, lichess): everything comes
+// from detection.ini and the square colour calibration
+struct AdaptivePolicy : ConfigBorder {
+    bool calibrated;
+    int whiteAbove, blackBelow;
+    int whiteThreshold, blackThreshold;
+
+    explicit AdaptivePolicy(const SitePolicyParams &params)
+        : ConfigBorder(params), calibrated(params.piecesCalibrated),
+          whiteAbove(params.whiteAbove), blackBelow(params.blackBelow),
+          whiteThreshold(params.whiteThreshold), blackThreshold(params.blackThreshold) {}
+
+    bool White(int color) const {
+        if (calibrated)
+            return MaxChannel(color) > whiteAbove;
+        return ChannelsAbove(color, whiteThreshold);
+    }
+    bool Black(int color) const {
+        if (calibrated)
+            return MaxChannel(color) < blackBelow;
+        return ChannelsBelow(color, blackThreshold);
+    }
+    bool Mark(int /*color*/) const { return false; }
+};
+
+// Reads the classes of Direct out of the site's colour class table;
+// whole rows still go through Direct's batched kernels
+template<class Direct>
+struct TablePolicy {
+    Direct direct;
+    const unsigned char *classes;
+
+    explicit TablePolicy(const SitePolicyParams &params)
+        : direct(params), classes(params.Table().Data()) {}
+
+    void BorderRow(const int *row, int count, unsigned char *mask) const {
+        direct.BorderRow(row, count, mask);
+    }
+
+    void PieceRow(const int *row, int count, unsigned char *mask) const {
+        // ClassWhite and ClassBlack sit one bit above the piece mask bits
+        for (int i=0; i<count; i++)
+            mask[i] = (classes[row[i] & 0xFFFFFF] >> 1) & (PIECE_MASK_WHITE | PIECE_MASK_BLACK);
+    }
+
+    bool Border(int color) const { return (classes[color & 0xFFFFFF] & ClassBorder) != 0; }
+    bool White(int color) const { return (classes[color & 0xFFFFFF] & ClassWhite) != 0; }
+    bool Black(int color) const { return (classes[color & 0xFFFFFF] & ClassBlack) != 0; }
+    bool Mark(int color) const { return (classes[color & 0xFFFFFF] & ClassMark) != 0; }
+};
+
+// The policy that evaluates the predicates itself, used to fill tables
+template<class Policy>
+struct DirectPolicy {
+    typedef Policy Type;
+};
+
+template<class Direct>
+struct DirectPolicy<TablePolicy<Direct> > {
+    typedef Direct Type;
+};
+
+// Calls target.UsePolicy<Policy>() with the policy of the site
+template<class Target>
+void SelectSitePolicy(int programType, Target &target)
+{
+    switch (programType) {
+        case chessbase:        target.template UsePolicy<ChessbasePolicy>(); break;
+        case chessassistant:   target.template UsePolicy<ChessassistantPolicy>(); break;
+        case bereg:            target.template UsePolicy<BeregPolicy>(); break;
+        case instantchess:     target.template UsePolicy<InstantchessPolicy>(); break;
+        case kurnik:           target.template UsePolicy<KurnikPolicy>(); break;
+        case winboard:         target.template UsePolicy<WinboardPolicy>(); break;
+        case chessgate:        target.template UsePolicy<TablePolicy<ChessgatePolicy> >(); break;
+        case spinchat:         target.template UsePolicy<SpinchatPolicy>(); break;
+        case chessclub_dasher: target.template UsePolicy<ChessclubDasherPolicy>(); break;
+        default:               target.template UsePolicy<TablePolicy<AdaptivePolicy> >(); break;
+    }
+}
+
+#endif
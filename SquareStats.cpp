@@ -0,0 +1,115 @@
+//---------------------------------------------------------------------------
+#include "SquareStats.h"
+
+//---------------------------------------------------------------------------
+
+double SquareStats::Variance() const
+{
+  if (!pixels)
+    return 0.0;
+  double mean = (double)brightness/pixels;
+  double variance = (double)brightness2/pixels - mean*mean;
+  return variance > 0 ? variance : 0.0;
+}
+
+const uint64 TSquareStats::ClassCounts[4] = {
+  0,
+  1 | ((uint64)1)<<(2*CountBits),
+  ((uint64)1)<<CountBits | ((uint64)1)<<(2*CountBits),
+  1 | ((uint64)1)<<CountBits | ((uint64)1)<<(2*CountBits)
+};
+
+TSquareStats::TSquareStats()
+{
+  Size = 0;
+  Built = 0;
+  Coloured = 0;
+}
+
+void TSquareStats::Prepare(int size, uint64 squares, bool colours)
+{
+  if (size != Size) {
+    Size = size;
+    Built = Coloured = 0;
+  }
+  if (size <= 0)
+    return;
+  Built |= squares;
+  if (colours)
+    Coloured |= squares;
+  else
+    Coloured &= ~squares;
+}
+
+// Total of a plane over the rectangle between corners (x0,y0) and (x1,y1)
+template<class T>
+static T RectSum(const std::vector<T> &plane, int stride, int x0, int y0, int x1, int y1)
+{
+  return plane[y1*stride + x1] - plane[y0*stride + x1] - plane[y1*stride + x0] + plane[y0*stride + x0];
+}
+
+SquareStats TSquareStats::Rect(int sq, int x, int y, int w, int h) const
+{
+  SquareStats stats;
+  if (!Covers(sq))
+    return stats;
+  int x1 = x + w > Size ? Size : x + w;
+  int y1 = y + h > Size ? Size : y + h;
+  if (x < 0)
+    x = 0;
+  if (y < 0)
+    y = 0;
+  if (x1 <= x || y1 <= y)
+    return stats;
+  int stride = Size + 1;
+  const Integral &in = Squares[sq];
+  stats.pixels = (x1 - x)*(y1 - y);
+  // Every count of a rectangle is non-negative and fits its field, so the
+  // packed word subtracts without borrows between the fields
+  uint64 counts = RectSum(in.counts, stride, x, y, x1, y1);
+  const uint64 mask = (((uint64)1)<<CountBits) - 1;
+  stats.white = (int)(counts & mask);
+  stats.black = (int)((counts>>CountBits) & mask);
+  stats.pieces = (int)((counts>>(2*CountBits)) & mask);
+  if (Coloured & (((uint64)1)<<sq)) {
+    for (int c=0; c<3; c++)
+      stats.sum[c] = RectSum(in.sum[c], stride, x, y, x1, y1);
+    stats.brightness = RectSum(in.brightness, stride, x, y, x1, y1);
+    stats.brightness2 = RectSum(in.brightness2, stride, x, y, x1, y1);
+  }
+  return stats;
+}
+
+bool TSquareStats::HasBlock(int sq, int x, int y, int rw, int rh, int w, int h, bool white) const
+{
+  if (!Covers(sq))
+    return false;
+  int x1 = x + rw > Size ? Size : x + rw;
+  int y1 = y + rh > Size ? Size : y + rh;
+  if (x < 0)
+    x = 0;
+  if (y < 0)
+    y = 0;
+  if (w <= 0 || h <= 0)
+    return x1 > x && y1 > y;
+  if (x1 - x < w || y1 - y < h)
+    return false;
+  int stride = Size + 1;
+  int shift = white ? 0 : CountBits;
+  const uint64 mask = (((uint64)1)<<CountBits) - 1;
+  const uint64 full = (uint64)w*h;
+  const uint64 *counts = &Squares[sq].counts[0];
+  for (int top=y; top+h<=y1; top++) {
+    const uint64 *a = counts + top*stride;
+    const uint64 *c = a + h*stride;
+    // The whole band must hold at least one block's worth first
+    if ((((c[x1] - a[x1] - c[x] + a[x])>>shift) & mask) < full)
+      continue;
+    for (int left=x; left+w<=x1; left++) {
+      uint64 block = c[left+w] - a[left+w] - c[left] + a[left];
+      if (((block>>shift) & mask) == full)
+        return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,158 @@
+//---------------------------------------------------------------------------
+#ifndef SquareStatsH
+#define SquareStatsH
+
+#include <cstring>
+#include <vector>
+#include "my_util.h"
+
+//---------------------------------------------------------------------------
+// Integral images of the squares of a board. Every pixel of a built square
+// adds its channels, its brightness (c0+c1+c2)/3 and the square of that,
+// and whether the site policy's PieceRow calls it white, black or either
+// (PIECE_MASK_WHITE and PIECE_MASK_BLACK); the totals
+// of any rectangle inside the square are then four lookups. Squares are
+// built on demand and stay valid until rebuilt, so a frame costs one pass
+// over the squares that changed.
+//---------------------------------------------------------------------------
+
+// Totals over a rectangle of a square
+struct SquareStats {
+    int pixels;
+    int white, black;
+    int pieces;                  // White or black
+    unsigned int sum[3];         // Channel sums, low byte first
+    unsigned int brightness;     // Sum of (c0+c1+c2)/3
+    uint64 brightness2;          // Sum of its square
+
+    SquareStats() : pixels(0), white(0), black(0), pieces(0), brightness(0), brightness2(0) {
+        sum[0] = sum[1] = sum[2] = 0;
+    }
+    int Average(int channel) const { return pixels ? (int)(sum[channel]/pixels) : 0; }
+    double Mean() const { return pixels ? (double)brightness/pixels : 0.0; }
+    double Variance() const;
+};
+
+// Policy for squares where only colours and brightness are wanted
+struct NoPieceClasses {
+    void PieceRow(const int *, int count, unsigned char *mask) const { memset(mask, 0, count); }
+};
+
+class TSquareStats {
+  public:
+    TSquareStats();
+    // Forget the built squares, e.g. when a new frame was captured
+    void Reset() { Built = Coloured = 0; }
+    // (Re)builds the squares whose bit is set, for a board whose top-left
+    // square starts at start, squares size pixels wide; square sq is
+    // file sq&7 and rank sq>>3 in screen order like TFindPos. Without
+    // colours only the piece counts are kept, which is all occupancy
+    // needs and a fraction of the work.
+    template<class Policy>
+    void Build(const Policy &policy, const int *start, int stride, int size, uint64 squares,
+               bool colours = true);
+    // Build in two steps, for building squares on several threads: Prepare
+    // once, then BuildSquare for each square; distinct squares don't share
+    // any state
+    void Prepare(int size, uint64 squares, bool colours);
+    template<class Policy>
+    void BuildSquare(const Policy &policy, const int *start, int stride, int sq, bool colours);
+    bool Covers(int sq) const { return (Built & (((uint64)1)<<sq)) != 0; }
+    // Totals of the w x h rectangle at (x,y) of square sq, clipped to it;
+    // channel and brightness sums are 0 for squares built without colours
+    SquareStats Rect(int sq, int x, int y, int w, int h) const;
+    // Totals of square sq without inset pixels on each side
+    SquareStats Square(int sq, int inset) const {
+        return Rect(sq, inset, inset, Size - 2*inset, Size - 2*inset);
+    }
+    // Whether a w x h block of white (or black) pixels lies anywhere in
+    // the rectangle (x,y,rw,rh) of square sq
+    bool HasBlock(int sq, int x, int y, int rw, int rh, int w, int h, bool white) const;
+  private:
+    // (Size+1)^2 running totals of one square. The three piece counts
+    // share a word, 21 bits each, so occupancy reads and writes a single
+    // plane; colours get one plane per quantity.
+    struct Integral {
+        std::vector<uint64> counts;
+        std::vector<unsigned int> sum[3], brightness;
+        std::vector<uint64> brightness2;
+    };
+    static const int CountBits = 21;
+    // Packed count increments of a pixel by its piece mask
+    static const uint64 ClassCounts[4];
+    static const int ClassChunk = 256;  // Pixels classified at a time
+    int Size;
+    uint64 Built, Coloured;
+    Integral Squares[64];
+};
+
+template<class Policy>
+void TSquareStats::Build(const Policy &policy, const int *start, int stride, int size, uint64 squares,
+                         bool colours)
+{
+    Prepare(size, squares, colours);
+    for (int sq=0; sq<64; sq++)
+        if (squares & (((uint64)1)<<sq))
+            BuildSquare(policy, start, stride, sq, colours);
+}
+
+template<class Policy>
+void TSquareStats::BuildSquare(const Policy &policy, const int *start, int stride, int sq, bool colours)
+{
+    int size = Size;
+    if (size <= 0)
+        return;
+    int w = size + 1;
+    Integral &in = Squares[sq];
+    // Only the first row and column need clearing, the rest is written
+    in.counts.resize(w*w);
+    for (int i=0; i<w; i++)
+        in.counts[i] = 0;
+    if (colours) {
+        for (int c=0; c<3; c++)
+            in.sum[c].assign(w*w, 0);
+        in.brightness.assign(w*w, 0);
+        in.brightness2.assign(w*w, 0);
+    }
+    unsigned char classes[ClassChunk];
+    const int *origin = start + (sq>>3)*size*stride + (sq&7)*size;
+    for (int y=0; y<size; y++) {
+        const int *row = origin + y*stride;
+        const uint64 *up = &in.counts[y*w];
+        uint64 *out = &in.counts[(y + 1)*w];
+        uint64 run = 0;
+        out[0] = 0;
+        for (int x0=0; x0<size; x0+=ClassChunk) {
+            int n = size - x0 < ClassChunk ? size - x0 : ClassChunk;
+            policy.PieceRow(row + x0, n, classes);
+            for (int x=0; x<n; x++) {
+                run += ClassCounts[classes[x]];
+                out[x0 + x + 1] = up[x0 + x + 1] + run;
+            }
+        }
+        if (!colours)
+            continue;
+        int up_row = y*w + 1;
+        int out_row = (y + 1)*w + 1;
+        unsigned int sum0 = 0, sum1 = 0, sum2 = 0, bright = 0;
+        uint64 bright2 = 0;
+        for (int x=0; x<size; x++) {
+            unsigned int c0 = row[x] & 255;
+            unsigned int c1 = (row[x]>>8) & 255;
+            unsigned int c2 = (row[x]>>16) & 255;
+            unsigned int b = (c0 + c1 + c2)/3;
+            sum0 += c0;
+            sum1 += c1;
+            sum2 += c2;
+            bright += b;
+            bright2 += b*b;
+            in.sum[0][out_row + x] = in.sum[0][up_row + x] + sum0;
+            in.sum[1][out_row + x] = in.sum[1][up_row + x] + sum1;
+            in.sum[2][out_row + x] = in.sum[2][up_row + x] + sum2;
+            in.brightness[out_row + x] = in.brightness[up_row + x] + bright;
+            in.brightness2[out_row + x] = in.brightness2[up_row + x] + bright2;
+        }
+    }
+}
+
+#endif
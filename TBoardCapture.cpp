@@ -1,10 +1,17 @@
+#ifdef _WIN32
 #include <windows.h>
+#endif
+#include <algorithm>
 #include "TBoardCapture.h"
 #include "square.h"
 
 #define X_COORD(x)  ((x)&7)
 #define Y_COORD(y)  ((y)>>3)
 
+const int min_board_size = 100;
+const int locate_step = 8;    // row decimation of the coarse search
+const int track_margin = 16;  // extra pixels searched around a lost board
+
 void TBoardCapture::MakeMove(mv_t move, int board_reversed)
 {
   if (!BoardRecognized)
@@ -17,6 +24,7 @@ void TBoardCapture::MakeMove(mv_t move, int board_reversed)
      from = 63-from;
      to = 63-to;
   }
+#ifdef _WIN32
   int x = BitmapX + (BoardSize*X_COORD(from))/8 + BoardSize/16;
   int y = BitmapY + (BoardSize*Y_COORD(from))/8 + BoardSize/16;
   SetCursorPos(x,y);
@@ -29,161 +37,284 @@ void TBoardCapture::MakeMove(mv_t move, int board_reversed)
   //mouse_event(MOUSEEVENTF_LEFTDOWN,0,0,0,0);
   Sleep(10);
   mouse_event(MOUSEEVENTF_LEFTUP,0,0,0,0);
+#endif
 }
 
-int ClearAlphaCanal (int x)
-{
-  return x & 0xFFFFFF;
-}
 TBoardCapture::TBoardCapture()
 {
   BoardRecognized = false;
-  HDC screendc = GetDC(NULL);
-  int BitsPerPixel = GetDeviceCaps(screendc, BITSPIXEL);
-  if (BitsPerPixel < 32) {
-    ReleaseDC(0, screendc);
-    throw "Screen resolution is wrong";
-  }
-  ScreenSizeX = GetDeviceCaps(screendc, HORZRES);
-  ScreenSizeY = GetDeviceCaps(screendc, VERTRES);
-  ReleaseDC(0, screendc);
-  int count = ScreenSizeX * ScreenSizeY * 4;
-  ScreenBuffer = (int *)malloc(count);
-  if (ScreenBuffer == NULL)
-    throw "Memory not allocated";
-
-  memset(&BitmapInfo,sizeof(BITMAPINFO),0);
-  BitmapInfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-  BitmapInfo.bmiHeader.biWidth = ScreenSizeX;
-  BitmapInfo.bmiHeader.biHeight = -ScreenSizeY;
-  BitmapInfo.bmiHeader.biPlanes = 1;
-  BitmapInfo.bmiHeader.biBitCount = 32;
-  BitmapInfo.bmiHeader.biCompression = BI_BITFIELDS;
-  BitmapInfo.bmiHeader.biSizeImage = count;
-  BitmapInfo.bmiHeader.biClrUsed = 0;
-  BitmapInfo.bmiHeader.biClrImportant = 0;
-  
+  Captured = false;
+  TrackOnly = false;
+  FrameTime = 0;
+  ProgramType = chessbase;
+  ScreenBuffer = NULL;
+  ScreenSizeX = ScreenSizeY = 0;
+  FrameSource = OwnFrameSource = NULL;
+#ifdef _WIN32
+  OwnFrameSource = new TGdiFrameSource();
+  FrameSource = OwnFrameSource;
+#endif
   LoadDetectionConfig();
 }
 
 TBoardCapture::~TBoardCapture()
 {
-  free(ScreenBuffer);
+  delete OwnFrameSource;
+}
+
+void TBoardCapture::SetFrameSource(TFrameSource *source)
+{
+  FrameSource = source;
+  BoardRecognized = false;
+  Captured = false;
+}
+
+bool TBoardCapture::GrabFrame(int x, int y, int width, int height)
+{
+  CapturedFrame frame;
+  if (!FrameSource->Grab(x, y, width, height, frame))
+    return false;
+  ScreenBuffer = frame.pixels;
+  BitmapSizeX = frame.stride;
+  BitmapSizeY = frame.height;
+  GrabX = x;
+  GrabY = y;
+  FrameTime = frame.timestamp;
+  Gradients.Reset();
+  return true;
+}
+
+bool TBoardCapture::CaptureTracked()
+{
+  if (!GrabFrame(BitmapX, BitmapY, BoardSize + 4, BoardSize + 4))
+    return false;
+  StartPixel = ScreenBuffer + BitmapSizeX*2 + 2;
+  return (this->*CheckForBoardFn)(1,1,BitmapSizeX-2);
 }
 
 void TBoardCapture::CaptureBoard()
 {
   Captured = false;
+  if (FrameSource == NULL)
+    return;
+  UpdateSitePolicy();
   if (BoardRecognized) {
-    screendc = GetDC(NULL);
-    dc = CreateCompatibleDC(screendc);
-    BitmapSizeY = BitmapSizeX = BoardSize + 4;
-    BitmapInfo.bmiHeader.biWidth = BitmapSizeX;
-    BitmapInfo.bmiHeader.biHeight = -BitmapSizeY;
-    BitmapInfo.bmiHeader.biSizeImage = BitmapSizeX * BitmapSizeY * 4;
-    HBITMAP Bitmap = CreateCompatibleBitmap(screendc, BitmapSizeX, BitmapSizeY);
-    Handle = SelectObject(dc, Bitmap);
-    BitBlt(dc, 0, 0, BitmapSizeX, BitmapSizeY, screendc, BitmapX, BitmapY, SRCCOPY);
-    GetDIBits(dc,Bitmap,0,BitmapSizeY,ScreenBuffer,&BitmapInfo,DIB_RGB_COLORS);
-    StartPixel = ScreenBuffer + BitmapSizeX*2 + 2;
-    Release();
-    if (CheckForBoard(1,1,BitmapSizeX-2)) {
+    if (CaptureTracked()) {
       Captured = true;
       return;
     }
+    // Lost the board: search a small window around the last known
+    // rectangle before falling back to the whole screen
+    BoardRect last = GetBoardRect();
+    BoardRecognized = false;
+    int margin = BoardSize/4 + track_margin;
+    int x0 = BitmapX - margin < 0 ? 0 : BitmapX - margin;
+    int y0 = BitmapY - margin < 0 ? 0 : BitmapY - margin;
+    int x1 = BitmapX + BoardSize + 4 + margin;
+    int y1 = BitmapY + BoardSize + 4 + margin;
+    if (FrameSource->GetScreenSize(ScreenSizeX, ScreenSizeY)) {
+      if (x1 > ScreenSizeX)
+        x1 = ScreenSizeX;
+      if (y1 > ScreenSizeY)
+        y1 = ScreenSizeY;
+      if (x1 > x0 && y1 > y0 && GrabFrame(x0, y0, x1 - x0, y1 - y0) && LocateBoard()) {
+        Captured = BoardRecognized = CaptureTracked();
+        if (Captured)
+          return;
+      }
+    }
+    if (TrackOnly) {
+      // Someone else owns the global search; keep trying this rectangle
+      TrackBoard(last);
+      return;
+    }
   }
+  if (TrackOnly)
+    return;
   BoardRecognized = false;
-  screendc = GetDC(NULL);
-  dc = CreateCompatibleDC(screendc);
-  HBITMAP Bitmap;
-  BitmapInfo.bmiHeader.biWidth = ScreenSizeX;
-  BitmapInfo.bmiHeader.biHeight = -ScreenSizeY;
-  BitmapInfo.bmiHeader.biSizeImage = ScreenSizeX * ScreenSizeY * 4;
-  Bitmap = CreateCompatibleBitmap(screendc, ScreenSizeX, ScreenSizeY);
-  Handle = SelectObject(dc, Bitmap);
-  BitBlt(dc, 0, 0, ScreenSizeX, ScreenSizeY, screendc, 0, 0, SRCCOPY);
-  GetDIBits(dc,Bitmap,0,ScreenSizeY,ScreenBuffer,&BitmapInfo,DIB_RGB_COLORS);
-  Release();
+  if (!CaptureScreen())
+    return;
   //Sleep(10);
-  BitmapSizeX = ScreenSizeX;
-  BitmapSizeY = ScreenSizeY;
-  int xFirst;
-  const int min_board_size = 100;
-  for (int y=1; y<ScreenSizeY-1; y++) {
-    int phase = 0;
-    for (int x=1; x<ScreenSizeX-1; x++)
-      switch (phase) {
-        case 0:
-          if (ColorIsBorder(ScreenBuffer[y*ScreenSizeX+x])) {
-            phase = 1;
-            xFirst = x;
-          }
-          break;
-        case 1:
-          if (!ColorIsBorder(ScreenBuffer[y*ScreenSizeX+x])) {
-            if (x - xFirst >= min_board_size) {
-              if (CheckForBoard(xFirst,y,x-xFirst)) {
-                BoardRecognized = true;
-                BitmapX = xFirst - 1;
-                BitmapY = y - 1;
-                StartPixel = ScreenBuffer + BitmapSizeX*2*y + xFirst + 1;
-                BoardSize = x-xFirst-2;
-                Captured = true;
-                //Sleep(10);
-                CaptureBoard();
-                return;
-              }
-            }
-            else
-              phase = 0;
-          }
+  if (LocateBoard())
+    Captured = BoardRecognized = CaptureTracked();
+}
+
+template<class Policy>
+void TBoardCapture::FindCandidates()
+{
+  Policy policy(PolicyParams);
+  // Coarse level: look at every locate_step-th row only and count, per
+  // column, how many sampled rows in a row hit a border pixel. The left
+  // edge of any board is a vertical border line at least
+  // min_board_size-2 pixels long, so it shows up as such a streak.
+  // Borders are one pixel thin, so columns are kept at full resolution.
+  int width = BitmapSizeX;
+  int height = BitmapSizeY;
+  int need = (min_board_size - 2)/locate_step - 1;
+  LineHits.assign(width, 0);
+  LineTops.assign(width, -1);
+  BorderMask.resize(width);
+  Candidates.clear();
+  for (int y=1; y<height-1; y+=locate_step) {
+    int *row = ScreenBuffer + y*width;
+    policy.BorderRow(row, width, &BorderMask[0]);
+    for (int x=1; x<width-1; x++) {
+      if (!BorderMask[x]) {
+        LineHits[x] = 0;
+        continue;
       }
+      int hits = ++LineHits[x];
+      if (hits < need || (hits - need) % need != 0)
+        continue;
+      // Fine level: climb to the top of the line at full resolution
+      int top = y;
+      while (top > 1 && policy.Border(ScreenBuffer[(top-1)*width + x]))
+        top--;
+      if (top == LineTops[x])
+        continue;
+      LineTops[x] = top;
+      // The top border row must start at this column
+      if (x == 1 || !policy.Border(ScreenBuffer[top*width + x - 1]))
+        Candidates.push_back(top*width + x);
+    }
   }
+  // Screen order, so the first board accepted is the same one a
+  // row-by-row scan would have found first
+  std::sort(Candidates.begin(), Candidates.end());
 }
 
-void TBoardCapture::Release()
+template<class Policy>
+bool TBoardCapture::CheckCandidate(int candidate, BoardRect &rect)
 {
-   DeleteObject(SelectObject(dc, Handle));
-   DeleteDC(dc);
-   ReleaseDC(0, screendc);
+  Policy policy(PolicyParams);
+  int width = BitmapSizeX;
+  int height = BitmapSizeY;
+  int top = candidate / width;
+  int xFirst = candidate % width;
+  int *row = ScreenBuffer + top*width;
+  int end = xFirst;
+  while (end < width-1 && policy.Border(row[end]))
+    end++;
+  if (end - xFirst < min_board_size)
+    return false;
+  int line = 0;
+  while (top + line < height && policy.Border(ScreenBuffer[(top+line)*width + xFirst]))
+    line++;
+  // Boards taller than the left line cannot pass CheckForBoard
+  for (int x=end; x<width-1 && x-xFirst-2 <= line; x++) {
+    if (policy.Border(row[x]))
+      continue;
+    if (CheckForBoard<Policy>(xFirst,top,x-xFirst)) {
+      rect.x = GrabX + xFirst - 1;
+      rect.y = GrabY + top - 1;
+      rect.size = x-xFirst-2;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool TBoardCapture::LocateBoard()
+{
+  (this->*FindCandidatesFn)();
+  BoardRect rect;
+  for (size_t i=0; i<Candidates.size(); i++)
+    if ((this->*CheckCandidateFn)(Candidates[i], rect)) {
+      TrackBoard(rect);
+      return true;
+    }
+  return false;
+}
+
+void TBoardCapture::LocateBoards(std::vector<BoardRect> &boards)
+{
+  boards.clear();
+  UpdateSitePolicy();
+  (this->*FindCandidatesFn)();
+  BoardRect rect;
+  for (size_t i=0; i<Candidates.size(); i++) {
+    int x = GrabX + Candidates[i] % BitmapSizeX;
+    int y = GrabY + Candidates[i] / BitmapSizeX;
+    bool inside = false;
+    for (size_t j=0; j<boards.size() && !inside; j++)
+      inside = x >= boards[j].x && x < boards[j].x + boards[j].size + 4 &&
+               y >= boards[j].y && y < boards[j].y + boards[j].size + 4;
+    if (!inside && (this->*CheckCandidateFn)(Candidates[i], rect))
+      boards.push_back(rect);
+  }
+}
+
+bool TBoardCapture::CaptureScreen()
+{
+  if (FrameSource == NULL || !FrameSource->GetScreenSize(ScreenSizeX, ScreenSizeY))
+    return false;
+  return GrabFrame(0, 0, ScreenSizeX, ScreenSizeY);
+}
+
+void TBoardCapture::GetFrame(CapturedFrame &frame)
+{
+  frame.pixels = ScreenBuffer;
+  frame.stride = BitmapSizeX;
+  frame.width = BitmapSizeX;
+  frame.height = BitmapSizeY;
+  frame.timestamp = FrameTime;
+}
+
+void TBoardCapture::TrackBoard(const BoardRect &rect)
+{
+  BitmapX = rect.x;
+  BitmapY = rect.y;
+  BoardSize = rect.size;
+  BoardRecognized = true;
+}
+
+BoardRect TBoardCapture::GetBoardRect()
+{
+  BoardRect rect;
+  rect.x = BitmapX;
+  rect.y = BitmapY;
+  rect.size = BoardRecognized ? BoardSize : 0;
+  return rect;
 }
 
-bool TBoardCapture::FindNotBlack(int x, int y, int size)
+template<class Policy>
+bool TBoardCapture::FindNotBlack(const Policy &policy, int x, int y, int size)
 {
    int *start = ScreenBuffer + y*BitmapSizeX + x;
    int *cur = start;
    for (int i=0; i<size; i++) {
-     if (!ColorIsBorder(*cur))
+     if (!policy.Border(*cur))
        return true;
      cur++;
    }
    cur += 1;
-   if (ColorIsBorder(*cur))
+   if (policy.Border(*cur))
      return true;
    cur = start;
    for (int i=0; i<size; i++) {
-     if (!ColorIsBorder(*cur))
+     if (!policy.Border(*cur))
        return true;
      cur += BitmapSizeX;
    }
    cur += BitmapSizeX;
-   if (ColorIsBorder(*cur))
+   if (policy.Border(*cur))
      return true;
    return false;
 }
 
-bool TBoardCapture::FindBlack(int x, int y, int size)
+template<class Policy>
+bool TBoardCapture::FindBlack(const Policy &policy, int x, int y, int size)
 {
    int *start = ScreenBuffer + y*BitmapSizeX + x;
    int *cur = start;
    for (int i=0; i<size; i++) {
-     if (ColorIsBorder(*cur))
+     if (policy.Border(*cur))
        return true;
      cur++;
    }
    cur = start;
    for (int i=0; i<size; i++) {
-     if (ColorIsBorder(*cur))
+     if (policy.Border(*cur))
        return true;
      cur += BitmapSizeX;
    }
@@ -197,23 +328,25 @@ bool TBoardCapture::CheckForBoardWithEdges(int x, int y, int size)
     return false;
     
   // Try edge-based detection for better accuracy
-  if (DetectBoardWithEdges(ScreenBuffer, x, y, size, BitmapSizeX, BitmapSizeY)) {
+  if (DetectBoardWithEdges(Gradients, ScreenBuffer, x, y, size, BitmapSizeX, BitmapSizeY)) {
     return true;
   }
   
   // Fallback to original method if edge detection doesn't find board
-  return CheckForBoard(x, y, size);
+  return (this->*CheckForBoardFn)(x, y, size);
 }
 
+template<class Policy>
 bool TBoardCapture::CheckForBoard(int x, int y, int size)
 {
   if ((y + size > BitmapSizeY - 1) || (x + size > BitmapSizeX))
     return false;
+  Policy policy(PolicyParams);
   if (ProgramType == spinchat)
-    return !FindBlack(x-1,y-1,size-4) && !FindNotBlack(x,y,size-2) && !ColorIsWhite(x-1,y-1);
+    return !FindBlack(policy,x-1,y-1,size-4) && !FindNotBlack(policy,x,y,size-2) && !ColorIsWhite(x-1,y-1);
   if (ProgramType==kurnik || ProgramType==winboard || ProgramType==bereg)
-    return !FindBlack(x-1,y-1,size-4) && !FindNotBlack(x,y,size-2) && !ColorIsWhite(x+1,y+1);
-  if (!FindBlack(x-1,y-1,size-4) && !FindNotBlack(x,y,size-2) && !FindBlack(x+1,y+1,size-4))
+    return !FindBlack(policy,x-1,y-1,size-4) && !FindNotBlack(policy,x,y,size-2) && !ColorIsWhite(x+1,y+1);
+  if (!FindBlack(policy,x-1,y-1,size-4) && !FindNotBlack(policy,x,y,size-2) && !FindBlack(policy,x+1,y+1,size-4))
     return true;
   return false;
 }
@@ -229,6 +362,7 @@ bool TBoardCapture::ColorIsWhite(int x, int y)
 
 void TBoardCapture::LoadDetectionConfig()
 {
+  unsigned int revision = DetectionConfig.revision;
   // Start with default configuration
   DetectionConfig = GetDefaultConfig(ProgramType);
   
@@ -239,57 +373,33 @@ void TBoardCapture::LoadDetectionConfig()
     // Configuration is already updated by LoadSiteConfig
   }
   // Otherwise use defaults
+  DetectionConfig.revision = revision + 1;
+  SetupSitePolicy();
 }
 
-bool TBoardCapture::ColorIsBorderAdaptive(int color)
+void TBoardCapture::SetupSitePolicy()
 {
-  // Use adaptive color matching with threshold
-  if (DetectionConfig.border.useExactMatch) {
-    // Fallback to exact match for backward compatibility
-    return ClearAlphaCanal(color) == ClearAlphaCanal(DetectionConfig.border.color);
-  }
-  
-  // Use color distance threshold for more robust matching
-  double distance = ColorDistance(ClearAlphaCanal(color), 
-                                   ClearAlphaCanal(DetectionConfig.border.color));
-  return distance <= DetectionConfig.border.colorThreshold;
+  // Resolve the site's pixel policy and colour table once, not per pixel
+  PolicyParams.Setup(ProgramType, DetectionConfig);
+  SelectSitePolicy(ProgramType, *this);
+  PolicySite = ProgramType;
+  PolicyRevision = DetectionConfig.revision;
 }
 
-bool TBoardCapture::ColorIsBorder(int color)
+void TBoardCapture::UpdateSitePolicy()
 {
-  // Try adaptive detection first
-  bool adaptiveResult = ColorIsBorderAdaptive(color);
-  
-  // For certain sites with multiple border colors, check additional colors
-  int res_color = ClearAlphaCanal(color);
-  int r,g,b;
-  switch (ProgramType) {
-    case chessbase:
-      return color == 0;
-    case bereg:
-      return color == 0 || (color == ((64<<16) + (64<<8) + 64));
-    case chessassistant:
-      return color == ((113<<16) + (111<<8) + 100) || color == ((133<<16) + (135<<8) + 140) || color == ((64<<16) + (64<<8) + 64);
-    case instantchess: case kurnik:
-      return ClearAlphaCanal(color) == 0;
-    case winboard:
-      return color == 0 || color == ((255<<16) + (255<<8));
-    case chessgate:
-      return adaptiveResult;
-    case spinchat:
-      return (ClearAlphaCanal(color) == (255<<16) + (234<<8) + 157) ||
-             (ClearAlphaCanal(color) == (164<<16) + (110<<8) + 48) ||
-             (ClearAlphaCanal(color) == (80<<16) + (53<<8) + 23) ||
-             (ClearAlphaCanal(color) == (140<<16) + (114<<8) + 77) ||
-             (ClearAlphaCanal(color) == (178<<8) ||
-             (ClearAlphaCanal(color) == (178<<16)));
-    case chessclub_dasher:
-      r = (res_color >> 16) & 255;
-      g = (res_color >> 8) & 255;
-      b = res_color & 255;
-      return (r > 55 && r < 60) && (g > 33 && g <39) && (b > 17 && b < 23);
-  }
-  return false;
+  if (PolicySite != ProgramType)
+    LoadDetectionConfig();
+  else if (PolicyRevision != DetectionConfig.revision)
+    SetupSitePolicy();
+}
+
+template<class Policy>
+void TBoardCapture::UsePolicy()
+{
+  FindCandidatesFn = &TBoardCapture::FindCandidates<Policy>;
+  CheckCandidateFn = &TBoardCapture::CheckCandidate<Policy>;
+  CheckForBoardFn = &TBoardCapture::CheckForBoard<Policy>;
 }
 
 void TBoardCapture::ShowScreen()
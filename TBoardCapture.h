@@ -3,26 +3,24 @@
 #ifndef TBoardCaptureH
 #define TBoardCaptureH
 
-#include <windows.h>
+#include <vector>
 #include "move.h"
+#include "FrameSource.h"
 #include "ColorUtils.h"
 #include "DetectionConfig.h"
 #include "ConfigLoader.h"
 #include "EdgeDetection.h"
+#include "SitePolicies.h"
 //---------------------------------------------------------------------------
 
-const int chessbase = 0;
-const int chessassistant = 1;
-const int bereg = 2;
-const int instantchess = 3;
-const int kurnik = 4;
-const int winboard = 5;
-const int chessgate = 6;
-const int spinchat = 7;
-const int chessclub_dasher = 8;
-const int chesscom = 9;
-const int lichess = 10;
+// Board rectangle on screen: the captured area starts one pixel outside
+// the border line and spans BoardSize + 4 pixels
+struct BoardRect {
+    int x, y;
+    int size;
 
+    BoardRect() : x(0), y(0), size(0) {}
+};
 
 class TBoardCapture {
   public:
@@ -36,26 +34,48 @@ class TBoardCapture {
     void CaptureBoard();
     void ShowScreen();
     void MakeMove(mv_t move, int board_reversed);
+    void SetFrameSource(TFrameSource *source);
+    void LoadDetectionConfig();
+    bool CaptureScreen();
+    void GetFrame(CapturedFrame &frame);
+    void LocateBoards(std::vector<BoardRect> &boards);
+    void TrackBoard(const BoardRect &rect);
+    BoardRect GetBoardRect();
+    bool TrackOnly;
     SiteDetectionConfig DetectionConfig;
+    unsigned int FrameTime;
   private:
     bool BoardRecognized;
+    TFrameSource *FrameSource;
+    TFrameSource *OwnFrameSource;
     int *ScreenBuffer;
     int ScreenSizeX, ScreenSizeY;
-    HDC dc, screendc;
-    HGDIOBJ Handle;
-    BITMAPINFO BitmapInfo;
-    int Dummy[4]; //HACK
     int BitmapX, BitmapY, BitmapSizeY;
-    bool ColourIsBorder(int colour);
-    bool FindBlack(int x, int y, int size);
-    bool FindNotBlack(int x, int y, int size);
-    bool CheckForBoard(int x, int y, int size);
-    bool ColorIsBorder(int color);
-    bool ColorIsBorderAdaptive(int color);
+    int GrabX, GrabY;
+    std::vector<int> LineHits, LineTops, Candidates;
+    std::vector<unsigned char> BorderMask;
+    TGradientImage Gradients;
+    // Border scans instantiated for the site policy, picked once per site
+    int PolicySite;
+    unsigned int PolicyRevision;
+    SitePolicyParams PolicyParams;
+    void (TBoardCapture::*FindCandidatesFn)();
+    bool (TBoardCapture::*CheckCandidateFn)(int candidate, BoardRect &rect);
+    bool (TBoardCapture::*CheckForBoardFn)(int x, int y, int size);
+    void UpdateSitePolicy();
+    void SetupSitePolicy();
+    template<class Policy> void UsePolicy();
+    template<class Target> friend void SelectSitePolicy(int programType, Target &target);
+    bool GrabFrame(int x, int y, int width, int height);
+    bool CaptureTracked();
+    bool LocateBoard();
+    template<class Policy> void FindCandidates();
+    template<class Policy> bool CheckCandidate(int candidate, BoardRect &rect);
+    template<class Policy> bool FindBlack(const Policy &policy, int x, int y, int size);
+    template<class Policy> bool FindNotBlack(const Policy &policy, int x, int y, int size);
+    template<class Policy> bool CheckForBoard(int x, int y, int size);
     bool ColorIsWhite(int x, int y);
     bool CheckForBoardWithEdges(int x, int y, int size);
-    void Release();
-    void LoadDetectionConfig();
 };
 
 #endif
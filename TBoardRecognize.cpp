@@ -1,12 +1,33 @@
 //---------------------------------------------------------------------------
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
 #include "TBoardRecognize.h"
 #include "find_pos.h"
 
 #define X_COORD(x)  ((x)&7)
 #define Y_COORD(y)  ((y)>>3)
 
+const int tile_samples = 16; // fingerprint samples per square side
+const int theme_changes = 32; // squares changing at once that recheck the theme
+
 TBoardRecognize::TBoardRecognize()
 {
+  ProgramType = chessbase;
+  Pool = &TWorkerPool::Shared();
+  TilesValid = false;
+  TileBoardSize = 0;
+  PiecesValid = false;
+  ThemeKey = 0;
+  Highlighted = 0;
+  ThemeColours[0] = ThemeColours[1] = 0;
+  InTransit = false;
+  TransitFrames = 0;
+  Orientation = orientation_unknown;
+  Changed = false;
+  ChangedSquares = 0;
+  memset(Confidence, CONFIDENCE_NONE, sizeof(Confidence));
 }
 
 TBoardRecognize::~TBoardRecognize()
@@ -17,118 +38,224 @@ void TBoardRecognize::ShowSquare(int sq)
 {
   // No GUI - this function would display detailed square pixels
   // in SquareViewForm for debugging purposes
-  // The data is still analyzed in IsPixelBlack/White but not displayed
+  // The data is still analyzed by the site pixel policy but not displayed
 }
 
-bool TBoardRecognize::IsPixelBlackAdaptive(int x)
+void TBoardRecognize::Recognize()
 {
-  // Use adaptive threshold based on detected square colors
-  SiteDetectionConfig& config = BoardCapture.DetectionConfig;
-  
-  if (config.piece.useAdaptive && config.colorsCalibrated) {
-    // Use contrast-based detection relative to dark square color
-    RGB pixelColor = UnpackColor(x);
-    HSV pixelHSV = RGBtoHSV(pixelColor);
-    HSV darkSquareHSV = RGBtoHSV(config.darkSquareColor);
-    
-    // Black piece should be significantly darker than dark square
-    return pixelHSV.v < (darkSquareHSV.v - 0.2);
+  BoardCapture.CaptureBoard();
+  Changed = false;
+  ChangedSquares = 0;
+  InTransit = false;
+  if (!BoardCapture.Captured) {
+    TilesValid = false;
+    PiecesValid = false;
+    Pieces.Clear();
+    Highlighted = 0;
+    Orientation = orientation_unknown;
+    return;
+  }
+  if (BoardCapture.BoardSize != TileBoardSize)
+    TilesValid = false;
+  // Reclassify only the squares whose tile fingerprint changed; an idle
+  // board costs one decimated pass over the squares and nothing else
+  unsigned int hashes[64];
+  uint64 changed = 0;
+  int changes = 0;
+  for (int i=0; i<64; i++) {
+    hashes[i] = TileHash(i);
+    if (!TilesValid || hashes[i] != TileHashes[i]) {
+      changed |= ((uint64)1)<<i;
+      changes++;
+    }
   }
-  
-  // Fallback to configured threshold
-  RGB pixelColor = UnpackColor(x);
-  return pixelColor.r < config.piece.blackThreshold && 
-         pixelColor.g < config.piece.blackThreshold && 
-         pixelColor.b < config.piece.blackThreshold;
+  // A new board or most squares changing at once (another theme, a new
+  // game) checks the theme; a calibration it runs changes the settings of
+  // every square
+  unsigned int revision = BoardCapture.DetectionConfig.revision;
+  if (!TilesValid || changes >= theme_changes)
+    UpdateTheme();
+  if (BoardCapture.DetectionConfig.revision != revision)
+    changed = ~(uint64)0;
+  Classifier.Setup(ProgramType, BoardCapture.DetectionConfig, BoardCapture.BoardSize);
+  // A frame of a move animation shows no position: it is dropped before
+  // any square is classified, and the tiles stay those of the last frame
+  InTransit = changed && FrameInTransit(BoardCapture.StartPixel, BoardCapture.BitmapSizeX,
+                                        BoardCapture.BoardSize, ThemeColours[1], ThemeColours[0]);
+  if (InTransit) {
+    TransitFrames++;
+    return;
+  }
+  for (int i=0; i<64; i++) {
+    if (!(changed & (((uint64)1)<<i)))
+      continue;
+    TileHashes[i] = hashes[i];
+    ChangedSquares++;
+  }
+  // Learned templates decide what they can; the site thresholds only
+  // see the squares they leave unknown
+  uint64 classify = MatchPieces(PiecesValid ? changed : ~(uint64)0, changed);
+  Classifier.Classify(BoardCapture.StartPixel, BoardCapture.BitmapSizeX, classify, FindPos, Confidence, Pool);
+  // A highlight comes or goes with the tile fingerprints of its squares,
+  // and so does the orientation with the pieces
+  if (changed) {
+    Highlighted = Highlight.Detect(BoardCapture.StartPixel, BoardCapture.BitmapSizeX, BoardCapture.BoardSize/8);
+    int orientation = PieceOrientation(FindPos);
+    if (orientation != orientation_unknown)
+      Orientation = orientation;
+  }
+  Changed = ChangedSquares > 0;
+  TilesValid = true;
+  TileBoardSize = BoardCapture.BoardSize;
 }
 
-bool TBoardRecognize::IsPixelBlack(int x)
+void TBoardRecognize::InvalidateTiles()
 {
-  int r = x & 255;
-  int g = (x>>8) & 255;
-  int b = (x>>16) & 255;
-  switch (ProgramType) {
-     case chessbase:
-        return r < 100 && g < 100 && b < 100;
-     case bereg: case instantchess: case kurnik:
-     case winboard: case chessassistant: case chessgate: case spinchat:
-     case chessclub_dasher:
-        return r < 50 && g < 50 && b < 50;
-  }
-  return false;
+  TilesValid = false;
 }
 
+// Template match of the given squares into Pieces and, where the match is
+// confident, into FindPos; returns the squares that still need the site
+// classification: those of changed the match leaves unknown, and those
+// whose reading came from an earlier match that no longer holds. The
+// other unknown squares keep their reading, their pixels are the same
+uint64 TBoardRecognize::MatchPieces(uint64 squares, uint64 changed)
+{
+  uint64 matched = 0;
+  for (int i=0; i<64; i++)
+    if (Pieces.square[i] != PieceUnknown12)
+      matched |= ((uint64)1)<<i;
+  if (!PieceTemplates.Ready()) {
+    PiecesValid = false;
+    Pieces.Clear();
+    return changed | matched;
+  }
+  uint64 unknown = 0;
+  int size = BoardCapture.BoardSize/8;
+  for (int i=0; i<64; i++) {
+    if (!(squares & (((uint64)1)<<i)))
+      continue;
+    int *start = BoardCapture.StartPixel + Y_COORD(i)*size*BoardCapture.BitmapSizeX + X_COORD(i)*size;
+    bool light = ((X_COORD(i) + Y_COORD(i)) & 1) == 0;
+    int piece = PieceTemplates.Match(start, size, BoardCapture.BitmapSizeX, light, &Pieces.score[i],
+                                     Pieces.match[i]);
+    Pieces.square[i] = piece;
+    if (piece == PieceUnknown12) {
+      unknown |= (changed | matched) & (((uint64)1)<<i);
+      continue;
+    }
+    for (int c=0; c<ColourNb; c++)
+      FindPos.find_pos[c] &= ~(((uint64)1)<<i);
+    Confidence[i] = CONFIDENCE_HIGH;
+    if (piece != PieceNone12)
+      FindPos.SetBit((piece & 1) ? Black : White, i);
+  }
+  Pieces.UpdateComplete();
+  PiecesValid = true;
+  return unknown;
+}
 
+void TBoardRecognize::ThemeFileName(char *name)
+{
+  sprintf(name, "pieces_%08x.tpl", ThemeKey);
+}
 
-bool TBoardRecognize::IsPixelWhiteAdaptive(int x)
+// Square colours of the board, taken from a corner of every square that
+// pieces rarely reach, pick the template cache of the theme
+void TBoardRecognize::UpdateTheme()
 {
-  // Use adaptive threshold based on detected square colors
-  SiteDetectionConfig& config = BoardCapture.DetectionConfig;
-  
-  if (config.piece.useAdaptive && config.colorsCalibrated) {
-    // Use contrast-based detection relative to light square color
-    RGB pixelColor = UnpackColor(x);
-    HSV pixelHSV = RGBtoHSV(pixelColor);
-    HSV lightSquareHSV = RGBtoHSV(config.lightSquareColor);
-    
-    // White piece should be significantly brighter than light square
-    return pixelHSV.v > (lightSquareHSV.v + 0.15);
+  int size = BoardCapture.BoardSize/8;
+  int inset = size/16;
+  std::vector<int> channels[2][3];
+  for (int i=0; i<64; i++) {
+    int pixel = BoardCapture.StartPixel[(Y_COORD(i)*size + inset)*BoardCapture.BitmapSizeX +
+                                        X_COORD(i)*size + inset];
+    int c = ((X_COORD(i) + Y_COORD(i)) & 1) == 0 ? 1 : 0;
+    channels[c][0].push_back((pixel>>16) & 255);
+    channels[c][1].push_back((pixel>>8) & 255);
+    channels[c][2].push_back(pixel & 255);
+  }
+  // Median per channel, so a highlighted square or two don't move it
+  unsigned int key = (2166136261u ^ (unsigned int)ProgramType) * 16777619u;
+  int colours[2] = { 0, 0 };
+  for (int c=0; c<2; c++) {
+    for (int k=0; k<3; k++) {
+      std::vector<int> &v = channels[c][k];
+      std::nth_element(v.begin(), v.begin() + v.size()/2, v.end());
+      key = (key ^ (unsigned int)(v[v.size()/2]>>2)) * 16777619u;
+      colours[c] |= v[v.size()/2]<<(16 - 8*k);
+    }
   }
-  
-  // Fallback to configured threshold
-  RGB pixelColor = UnpackColor(x);
-  return pixelColor.r > config.piece.whiteThreshold && 
-         pixelColor.g > config.piece.whiteThreshold && 
-         pixelColor.b > config.piece.whiteThreshold;
+  // The highlight tint is learned against these colours, and animation
+  // frames are told by them
+  Highlight.SetSquareColours(colours[1], colours[0]);
+  ThemeColours[0] = colours[0];
+  ThemeColours[1] = colours[1];
+  if (key != ThemeKey) {
+    ThemeKey = key;
+    Highlight.Clear();
+    PiecesValid = false;
+    char name[64];
+    ThemeFileName(name);
+    PieceTemplates.Load(name);
+  }
+  // Adaptive thresholds follow the squares the board shows now
+  SiteDetectionConfig &config = BoardCapture.DetectionConfig;
+  if (config.piece.useAdaptive && (!config.colorsCalibrated || PaletteDrifted(Palette, colours[1], colours[0])))
+    CalibrateSquareColors();
 }
 
-bool TBoardRecognize::IsPixelWhite(int x)
+// Learns the templates from the current frame, whose pieces are known
+void TBoardRecognize::LearnPieceTemplates(const BoardPieces &known)
 {
-  int r = x & 255;
-  int g = (x>>8) & 255;
-  int b = (x>>16) & 255;
-  switch (ProgramType) {
-     case chessassistant:
-        return r > 220 && g >220 && b > 220;
-     case chessbase:
-        return r > 190 && g >190 && b > 190;
-     case bereg:
-        return r > 240 && g >240 && b > 240;
-     case instantchess:
-        return r > 250 && g >250 && b > 250;
-     case kurnik:
-        return r > 250 && g >250 && b > 250;
-     case winboard:
-        return r > 190 && g >190 && b > 190;
-     case chessgate:
-        return r > 254 && g >254 && b > 254;
-     case spinchat:
-        return r > 190 && g >190 && b > 190;
-     case chessclub_dasher:
-        return r > 220 && g >220 && b > 220;
+  if (!BoardCapture.Captured)
+    return;
+  int size = BoardCapture.BoardSize/8;
+  // Empty squares first: the pieces are learned against them
+  for (int pass=0; pass<2; pass++) {
+    for (int i=0; i<64; i++) {
+      if ((known.square[i] == PieceNone12) != (pass == 0) || known.square[i] == PieceUnknown12)
+        continue;
+      // A highlighted square's background isn't the plain square colour
+      if (Highlighted & (((uint64)1)<<i))
+        continue;
+      int *start = BoardCapture.StartPixel + Y_COORD(i)*size*BoardCapture.BitmapSizeX + X_COORD(i)*size;
+      bool light = ((X_COORD(i) + Y_COORD(i)) & 1) == 0;
+      PieceTemplates.Learn(start, size, BoardCapture.BitmapSizeX, light, known.square[i]);
+    }
+  }
+  PiecesValid = false;
+  if (PieceTemplates.Ready()) {
+    char name[64];
+    ThemeFileName(name);
+    PieceTemplates.Save(name);
   }
-  return false;
 }
 
-bool TBoardRecognize::IsPixelMark(int x)
+void TBoardRecognize::LearnHighlight(int from, int to)
 {
-  int b = x & 255;
-  int g = (x>>8) & 255;
-  int r = (x>>16) & 255;
-  switch (ProgramType) {
-     case instantchess:
-        return r == 0 && g == 102 && b == 153;
-  }
-  return false;
+  if (!BoardCapture.Captured)
+    return;
+  int size = BoardCapture.BoardSize/8;
+  Highlight.Learn(BoardCapture.StartPixel, BoardCapture.BitmapSizeX, size,
+                  (((uint64)1)<<from) | (((uint64)1)<<to));
+  Highlighted = Highlight.Detect(BoardCapture.StartPixel, BoardCapture.BitmapSizeX, size);
 }
 
-void TBoardRecognize::Recognize()
+unsigned int TBoardRecognize::TileHash(int sq)
 {
-  BoardCapture.CaptureBoard();
-  if (BoardCapture.Captured) {
-    FindPos.Init();
-    ConvertBoardToFindPos();
+  int size = BoardCapture.BoardSize/8;
+  int step = size/tile_samples;
+  if (step < 1)
+    step = 1;
+  int *start = BoardCapture.StartPixel + Y_COORD(sq)*size*BoardCapture.BitmapSizeX + X_COORD(sq)*size;
+  unsigned int hash = 2166136261u;
+  for (int y=step/2; y<size; y+=step) {
+    int *cur = start + y*BoardCapture.BitmapSizeX;
+    for (int x=step/2; x<size; x+=step)
+      hash = (hash ^ (unsigned int)cur[x]) * 16777619u;
   }
+  return hash;
 }
 
 void TBoardRecognize::ShowPosition()
@@ -140,364 +267,40 @@ void TBoardRecognize::ShowPosition()
 
 void TBoardRecognize::ConvertBoardToFindPos()
 {
-   int size = BoardCapture.BoardSize/8;
-   int delta = size*BoardCapture.BitmapSizeX;
-   int corner = size/8;
-   int depth;
-   int width;
-   int recognize_type; //0 by pixels, 1 by square
-   int black_max;
-   bool calc_white = false;
-   
-   // Load from configuration first
-   RecognitionParams& params = BoardCapture.DetectionConfig.recognition;
-   
-   switch (ProgramType) {
-      case chessassistant:
-         width = size/4;
-         depth = 2;
-         corner = size/16;
-         recognize_type = 1;
-         params.width = width;
-         params.depth = depth;
-         params.corner = corner;
-         params.recognizeType = recognize_type;
-         break;
-      case chessbase:
-         width = size/4;
-         depth = 3;
-         corner = size/16;
-         recognize_type = 2;
-         black_max = 180;
-         calc_white = true;
-         params.width = width;
-         params.depth = depth;
-         params.corner = corner;
-         params.recognizeType = recognize_type;
-         params.blackMax = black_max;
-         params.calcWhite = calc_white;
-         break;
-      case bereg:
-         width = size/8;
-         depth = 4;
-         corner = size/16;
-         recognize_type = 1;
-         params.width = width;
-         params.depth = depth;
-         params.corner = corner;
-         params.recognizeType = recognize_type;
-         break;
-      case instantchess:
-         width = 7;
-         depth = 4;
-         corner = size/8;
-         recognize_type = 1;
-         black_max = 60;
-         params.width = width;
-         params.depth = depth;
-         params.corner = corner;
-         params.recognizeType = recognize_type;
-         params.blackMax = black_max;
-         break;
-      case kurnik:
-         width = size/8;
-         depth = width;
-         corner = size/16;
-         recognize_type = 1;
-         params.width = width;
-         params.depth = depth;
-         params.corner = corner;
-         params.recognizeType = recognize_type;
-         break;
-      case winboard:
-         width = size/4;
-         depth = 3;
-         corner = size/16;
-         recognize_type = 1;
-         params.width = width;
-         params.depth = depth;
-         params.corner = corner;
-         params.recognizeType = recognize_type;
-         break;
-      case chessgate:
-         width = size/4;
-         depth = 3;
-         corner = size/16;
-         recognize_type = 2;
-         calc_white = false;
-         black_max = 60;
-         params.width = width;
-         params.depth = depth;
-         params.corner = corner;
-         params.recognizeType = recognize_type;
-         params.calcWhite = calc_white;
-         params.blackMax = black_max;
-         break;
-      case spinchat:
-         width = size/6;
-         depth = 2;
-         corner = size/16;
-         recognize_type = 1;
-         params.width = width;
-         params.depth = depth;
-         params.corner = corner;
-         params.recognizeType = recognize_type;
-         break;
-      case chessclub_dasher:
-         width = size/6;
-         depth = 3;
-         corner = size/16;
-         recognize_type = 1;
-         params.width = width;
-         params.depth = depth;
-         params.corner = corner;
-         params.recognizeType = recognize_type;
-         break;
-   }
-   FindPos.Init();
-   for (int i=0; i<64; i++) {
-      int *start = BoardCapture.StartPixel + Y_COORD(i)*delta + X_COORD(i)*size +
-                  BoardCapture.BitmapSizeX*corner + corner;
-
-      int real_size = size - 2*corner;
-      switch (recognize_type) {
-        case 1:
-          do {
-            int *cur = start;
-            bool white_finded = false;
-            for (int j=0; j<real_size-depth+1; j++) {
-              if (CheckForWhite(cur,real_size,width,depth)) {
-                FindPos.SetBit(White,i);
-                white_finded = true;
-                break;
-              }
-              cur += BoardCapture.BitmapSizeX;
-            }
-            if (!white_finded) {
-              cur = start;
-              for (int j=0; j<real_size-depth-1; j++) {
-                if (CheckForBlack(cur,real_size,width,depth)) {
-                  FindPos.SetBit(Black,i);
-                  break;
-                }
-                cur += BoardCapture.BitmapSizeX;
-              }
-            }
-          }
-          while (false);
-          break;
-        case 2:
-          do {
-            int *temp_start = start;
-            int black_cnt = 0;
-            for (int y=0; y<real_size; y++) {
-              int *cur = temp_start;
-              for (int x=0; x<real_size; x++) {
-                if (IsPixelBlack(*cur) || (calc_white && IsPixelWhite(*cur)))
-                  black_cnt++;
-                cur++;
-              }
-              temp_start += BoardCapture.BitmapSizeX;
-            }
-            if (black_cnt > black_max) {
-              int *cur = start;
-              int black_finded = false;
-              for (int j=0; j<real_size-depth-1; j++) {
-                if (CheckForBlack(cur,real_size,width,depth)) {
-                  FindPos.SetBit(Black,i);
-                  black_finded = true;
-                  break;
-                }
-                cur += BoardCapture.BitmapSizeX;
-              }
-              if (!black_finded)
-                FindPos.SetBit(White,i);
-            }
-          }
-          while (false);
-          break;
-        case 3:
-          break;
-      }
-   }
-}
-
-bool TBoardRecognize::CheckForWhite(int *cur, int size, int width, int depth)
-{
-  if (depth <= 0)
-    return true;
-  int phase = 0;
-  int *start_ptr;
-  for (int i=0; i<size; i++) {
-    if (cur < BoardCapture.StartPixel || cur > BoardCapture.StartPixel + 1280*1024) {
-      int k; k++;
-    }
-    switch (phase) {
-      case 0:
-         if (IsPixelWhite(*cur)) {
-           start_ptr = cur;
-           phase = 1;
-         }
-         break;
-      case 1:
-         if (!IsPixelWhite(*cur)) {
-           if(cur-start_ptr>width) {
-             if (CheckForWhite(start_ptr + BoardCapture.BitmapSizeX, cur-start_ptr, width, depth - 1))
-               return true;
-           }
-           phase = 0;
-         }
-         break;
-    }
-    cur++;
-  }
-
-  if (phase == 1 && cur-start_ptr > width)
-    if (CheckForWhite(start_ptr + BoardCapture.BitmapSizeX,cur-start_ptr, width, depth - 1))
-      return true;
-
-  return false;
-}
-
-bool TBoardRecognize::CheckForBlack(int *cur, int size, int width, int depth)
-{
-  if (depth <= 0)
-    return true;
-  int phase = 0;
-  int *start_ptr;
-  for (int i=0; i<size; i++) {
-    switch (phase) {
-      case 0:
-         if (IsPixelBlack(*cur)) {
-           start_ptr = cur;
-           phase = 1;
-         }
-         break;
-      case 1:
-         if (!IsPixelBlack(*cur)) {
-           if(cur-start_ptr>width) {
-             if (CheckForBlack(start_ptr + BoardCapture.BitmapSizeX, cur-start_ptr, width, depth - 1))
-               return true;
-           }
-           phase = 0;
-         }
-         break;
-    }
-    cur++;
-  }
-
-  if (phase == 1 && cur-start_ptr > width)
-    if (CheckForBlack(start_ptr + BoardCapture.BitmapSizeX,cur-start_ptr, width, depth - 1))
-      return true;
-
-  return false;
+  Classifier.Setup(ProgramType, BoardCapture.DetectionConfig, BoardCapture.BoardSize);
+  FindPos.Init();
+  Classifier.Classify(BoardCapture.StartPixel, BoardCapture.BitmapSizeX, ~(uint64)0, FindPos, Confidence, Pool);
 }
 
 bool TBoardRecognize::SquareIsMarked(int sq)
 {
-  int size = BoardCapture.BoardSize/8;
-  int delta = size*BoardCapture.BitmapSizeX;
-  int *start = BoardCapture.StartPixel + Y_COORD(sq)*delta + X_COORD(sq)*size + BoardCapture.BoardSize/16;
-  for (int i=0; i<4; i++) {
-    if (IsPixelMark(*start))
-      return true;
-    start += BoardCapture.BitmapSizeX;
-  }
-  return false;
+  Classifier.Setup(ProgramType, BoardCapture.DetectionConfig, BoardCapture.BoardSize);
+  return Classifier.SquareIsMarked(BoardCapture.StartPixel, BoardCapture.BitmapSizeX, sq);
 }
 
 void TBoardRecognize::CalibrateSquareColors()
 {
-  // Auto-calibrate square colors from captured board
-  // Sample empty squares to determine light and dark square colors
-  // Use squares that are typically empty in starting position (d4, e5)
-  
-  if (!BoardCapture.Captured) {
+  // Clusters the colours of all squares, so any position will do; a
+  // palette measured before seeds the clusters
+  if (!BoardCapture.Captured)
     return;
-  }
-  
-  int size = BoardCapture.BoardSize / 8;
-  int delta = size * BoardCapture.BitmapSizeX;
-  int corner = size / 8;
-  int sampleSize = size / 4;
-  
-  // Sample empty squares from the center of the board
-  // d4 square (index 27) - light square in standard chess board
-  // d5 square (index 35) - dark square in standard chess board
-  int lightSquareIdx = 27; // d4
-  int darkSquareIdx = 35;  // d5
-  
-  // Sample light square (d4)
-  int *lightStart = BoardCapture.StartPixel + 
-                    Y_COORD(lightSquareIdx) * delta + 
-                    X_COORD(lightSquareIdx) * size +
-                    BoardCapture.BitmapSizeX * corner + corner;
-  
-  // Sample dark square (d5)
-  int *darkStart = BoardCapture.StartPixel + 
-                   Y_COORD(darkSquareIdx) * delta + 
-                   X_COORD(darkSquareIdx) * size +
-                   BoardCapture.BitmapSizeX * corner + corner;
-  
-  // Thresholds for filtering out piece pixels (too bright or too dark)
-  const int MIN_SQUARE_BRIGHTNESS = 20;   // Exclude very dark (black pieces)
-  const int MAX_SQUARE_BRIGHTNESS = 240;  // Exclude very bright (white pieces)
-  const int MIN_LIGHT_BRIGHTNESS = 100;   // Light squares should be reasonably bright
-  const int MAX_DARK_BRIGHTNESS = 200;    // Dark squares should not be too bright
-  
-  // Average colors from center of each square
-  long lightR = 0, lightG = 0, lightB = 0;
-  long darkR = 0, darkG = 0, darkB = 0;
-  int lightSampleCount = 0;
-  int darkSampleCount = 0;
-  
-  for (int y = 0; y < sampleSize; y++) {
-    int *lightCur = lightStart + y * BoardCapture.BitmapSizeX;
-    int *darkCur = darkStart + y * BoardCapture.BitmapSizeX;
-    
-    for (int x = 0; x < sampleSize; x++) {
-      RGB lightRGB = UnpackColor(*lightCur);
-      RGB darkRGB = UnpackColor(*darkCur);
-      
-      // Calculate average brightness across all channels
-      int lightBrightness = (lightRGB.r + lightRGB.g + lightRGB.b) / 3;
-      int darkBrightness = (darkRGB.r + darkRGB.g + darkRGB.b) / 3;
-      
-      // Skip pixels that are clearly pieces (very light or very dark)
-      // Use overall brightness instead of just red channel
-      if (lightBrightness > MIN_LIGHT_BRIGHTNESS && lightBrightness < MAX_SQUARE_BRIGHTNESS) {
-        lightR += lightRGB.r;
-        lightG += lightRGB.g;
-        lightB += lightRGB.b;
-        lightSampleCount++;
-      }
-      
-      if (darkBrightness > MIN_SQUARE_BRIGHTNESS && darkBrightness < MAX_DARK_BRIGHTNESS) {
-        darkR += darkRGB.r;
-        darkG += darkRGB.g;
-        darkB += darkRGB.b;
-        darkSampleCount++;
-      }
-      
-      lightCur++;
-      darkCur++;
-    }
-  }
-  
-  // Require minimum sample count for reliable calibration
-  const int MIN_SAMPLES_REQUIRED = 10; // Need at least 10 valid pixels per square
-  
-  if (lightSampleCount >= MIN_SAMPLES_REQUIRED && darkSampleCount >= MIN_SAMPLES_REQUIRED) {
-    BoardCapture.DetectionConfig.lightSquareColor.r = (int)(lightR / lightSampleCount);
-    BoardCapture.DetectionConfig.lightSquareColor.g = (int)(lightG / lightSampleCount);
-    BoardCapture.DetectionConfig.lightSquareColor.b = (int)(lightB / lightSampleCount);
-    
-    BoardCapture.DetectionConfig.darkSquareColor.r = (int)(darkR / darkSampleCount);
-    BoardCapture.DetectionConfig.darkSquareColor.g = (int)(darkG / darkSampleCount);
-    BoardCapture.DetectionConfig.darkSquareColor.b = (int)(darkB / darkSampleCount);
-    
-    BoardCapture.DetectionConfig.colorsCalibrated = true;
-    BoardCapture.DetectionConfig.CalibrateThresholds();
-  }
+  if (!MeasureThemePalette(BoardCapture.StartPixel, BoardCapture.BitmapSizeX, BoardCapture.BoardSize, Palette))
+    return;
+  SiteDetectionConfig &config = BoardCapture.DetectionConfig;
+  config.lightSquareColor = Palette.square[1];
+  config.darkSquareColor = Palette.square[0];
+  config.whiteMeasured = Palette.hasWhite;
+  config.blackMeasured = Palette.hasBlack;
+  if (Palette.hasWhite)
+    config.whitePieceColor = Palette.whitePiece;
+  if (Palette.hasBlack)
+    config.blackPieceColor = Palette.blackPiece;
+  config.colorsCalibrated = true;
+  // A highlight seen while clustering stands in until one is learned
+  for (int light=0; light<2; light++)
+    if (Palette.highlighted[light])
+      Highlight.SetTint(light, PackColor(Palette.highlight[light]));
+  // Bumps the config revision: the policies and colour table follow
+  // on the next scan
+  config.CalibrateThresholds();
 }
-
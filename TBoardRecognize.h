@@ -7,6 +7,9 @@
 #include "TBoardCapture.h"
 #include "find_pos.h"
 #include "ColorUtils.h"
+#include "PieceTemplates.h"
+#include "HighlightDetector.h"
+#include "FrameRecognize.h"
 //---------------------------------------------------------------------------
 
 class TBoardRecognize {
@@ -19,17 +22,58 @@ class TBoardRecognize {
     void ShowSquare(int sq);
     TBoardCapture BoardCapture;
     TFindPos FindPos;
+    // ConfidenceLevel of each square of FindPos
+    unsigned char Confidence[64];
     bool SquareIsMarked(int sq);
+    // Measures Palette and takes its square colours into the detection
+    // config; runs by itself for adaptive configs when the theme is new
+    // or drifted
     void CalibrateSquareColors();
+    ThemePalette Palette;
+    void InvalidateTiles();
+    bool Changed;
+    int ChangedSquares;
+    // The last frame caught a piece sliding across squares (see
+    // FrameInTransit) and was dropped: FindPos is still that of the
+    // frame before. TransitFrames counts them.
+    bool InTransit;
+    unsigned int TransitFrames;
+    // Side White plays from (see PieceOrientation), kept for as long as
+    // the board is tracked; each decisive frame, as a new game's always
+    // is, renews it
+    int Orientation;
+    // Site classification of the squares, the part of recognition that
+    // depends on nothing but the frame (see RecognizeFrame)
+    TSquareClassifier Classifier;
+    // Workers that classify squares when many change at once (a new
+    // board); NULL classifies on the calling thread. Results don't
+    // depend on it.
+    TWorkerPool *Pool;
+    // Piece identity of every square once the templates are complete.
+    // Templates are cached per board theme in pieces_<theme>.tpl and,
+    // when ready, replace the site thresholds for the squares they match
+    TPieceTemplates PieceTemplates;
+    BoardPieces Pieces;
+    // Learns the known squares of the current frame but the highlighted ones
+    void LearnPieceTemplates(const BoardPieces &known);
+    // Squares showing the site's last move highlight, once its tint is
+    // known; LearnHighlight teaches it from the squares of a move just
+    // recognized (screen order)
+    THighlightDetector Highlight;
+    uint64 Highlighted;
+    void LearnHighlight(int from, int to);
   private:
-    bool IsPixelWhite(int x);
-    bool IsPixelBlack(int x);
-    bool IsPixelMark(int x);
-    bool IsPixelWhiteAdaptive(int x);
-    bool IsPixelBlackAdaptive(int x);
     void ConvertBoardToFindPos();
-    bool CheckForWhite(int *cur, int size, int width, int depth);
-    bool CheckForBlack(int *cur, int size, int width, int depth);
+    unsigned int TileHash(int sq);
+    uint64 MatchPieces(uint64 squares, uint64 changed);
+    bool PiecesValid;
+    unsigned int ThemeKey;
+    int ThemeColours[2];         // Dark and light squares of the theme
+    void UpdateTheme();
+    void ThemeFileName(char *name);
+    unsigned int TileHashes[64];
+    bool TilesValid;
+    int TileBoardSize;
     board_t Board, StartBoard;
 };
 
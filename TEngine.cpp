@@ -20,20 +20,35 @@
 #include "move_gen.h"
 
 #include "find_pos.h"
+#include "MoveReconstruct.h"
+#include "PositionSynthesis.h"
 //---------------------------------------------------------------------------
 
 #define X_COORD(x)  ((x)&7)
 #define Y_COORD(y)  ((y)>>3)
 
-int TEngine::SquareTo_64(int x)
+// Fruit's tables, read by every board operation down to the hash keys;
+// set up once, by the first engine made on any entry point
+static bool InitFruit()
 {
-  int File = SQUARE_FILE(x) - 4;
-  int Rank = SQUARE_RANK(x) - 4;
-  return (Rank*8) + 7-File;
+  util_init();
+  my_random_init();
+  square_init();
+  piece_init();
+  pawn_init_bit();
+  value_init();
+  vector_init();
+  attack_init();
+  move_do_init();
+  random_init();
+  hash_init();
+  return true;
 }
 
 TEngine::TEngine(const std::string& FileName)
 {
+  static const bool fruit_ready = InitFruit();
+  (void)fruit_ready;
   UCIInterface = new TUCIInterface(FileName);
   Reversed = true;
   AutoPlay = false;
@@ -46,6 +61,9 @@ TEngine::TEngine(const std::string& FileName)
   StartNewGameEvent = false;
   MoveLimit = 38;
   SwitchOfEngineWhenOpponentMove = false;
+  Settled = false;
+  JoinTurn = ColourNone;
+  Reconstruction = RECONSTRUCT_NONE;
   board_from_fen(&StartBoard,StartFen);
 }
 TEngine::~TEngine()
@@ -57,7 +75,15 @@ bool TEngine::ExtractNewState(TState * new_state)
 {
   BoardRecognize.Recognize();
   PositionRecognized = false;
-  if (BoardRecognize.BoardCapture.Captured) {
+  Settled = false;
+  // Mid-animation frames show no position any moves could lead to
+  if (BoardRecognize.InTransit)
+    return false;
+  if (!BoardRecognize.BoardCapture.Captured)
+    Filter.Reset();
+  else {
+    Settled = Filter.Update(BoardRecognize.FindPos, BoardRecognize.Confidence,
+                            BoardRecognize.BoardCapture.FrameTime);
     FindPos = BoardRecognize.FindPos;
     if (Reversed)
       FindPos.Reverse();
@@ -79,38 +105,38 @@ bool TEngine::ExtractNewState(TState * new_state)
       }
     }
     *new_state = State;
-    if (State.Inited && GetNewState(new_state))
+    if (State.Inited && (GetNewStateFromPieces(new_state) || GetNewState(new_state)))
       PositionRecognized = true;
     else {
+      // A new game is near the start position, so the board mostly shows
+      // which side White plays from: the search runs that way round only.
+      // When it can't be told, the way round followed so far is searched
+      // first and then the other one
+      int orientation = BoardRecognize.Orientation;
+      bool known = orientation != orientation_unknown;
+      bool first = known ? orientation == orientation_white_below : Reversed;
+      bool searched = Reversed;
+      bool started = false;
       new_state->SetNewGame();
-      if (GetNewState(new_state)) {
-        new_state->Inited = true;
-        PositionRecognized = true;
-        InitTimers();
-        AutoPlay = false;
-        AutoPlayWhite = false;
-        AutoPlayBlack = false;
-        StartNewGameEvent = true;
-        move_locked = 0;
-        if (IsDebug)
-          Debug.OpenNewFile();
-      }
-      else {
-        FindPos.Reverse();
+      for (int i=0; i<(known ? 1 : 2) && !started; i++) {
+        bool reversed = i == 0 ? first : !first;
+        if (reversed != searched) {
+          FindPos.Reverse();
+          searched = reversed;
+        }
         if (GetNewState(new_state)) {
-          new_state->Inited = true;
-          PositionRecognized = true;
-          Reversed = !Reversed;
-          InitTimers();
-          AutoPlay = false;
-          AutoPlayWhite = false;
-          AutoPlayBlack = false;
-          StartNewGameEvent = true;
-          move_locked = 0;
-          if (IsDebug)
-            Debug.OpenNewFile();
+          Reversed = reversed;
+          StartGame(new_state);
+          LearnPieceTemplates(new_state);
+          started = true;
         }
       }
+      if (!started) {
+        if (searched != Reversed)
+          FindPos.Reverse();
+        if (!State.Inited && Settled && JoinPosition(new_state))
+          StartGame(new_state);
+      }
     }
   }
   if (IsDebug) {
@@ -143,12 +169,8 @@ void TEngine::Tick()
       }
       return;
     }
-    Sleep(50);
-    TState new_state2;
-    PositionRecognized = ExtractNewState(&new_state2);
-    if (!PositionRecognized)
-      return;
-    if (!new_state2.IsEqual(&new_state))
+    // Squares read with doubt wait for the next frames to agree
+    if (!Settled)
       return;
     if (move_locked) {
       if (new_state.GetLastMove()== move_locked)
@@ -167,6 +189,7 @@ void TEngine::Tick()
           BlackPlayer.OpenTime();
         }
         LastFindPos = FindPos;
+        LearnHighlight(&new_state);
       }
       if (IsDebug) {
         Debug.SaveString("state changed, new state is:");
@@ -242,30 +265,189 @@ void TEngine::StartNewThink()
 
 bool TEngine::GetNewState(TState * State)
 {
-   mv_t pv[3];
-   if (SearchPos(&State->Board,&FindPos,pv)) {
-      int pv_len = 0;
-      for (int i=0; i<3; i++) {
-        if (pv[i]==0)
-          break;
-        else
-          pv_len++;
+   mv_t pv[reconstruct_max_plies+1];
+   if (!Memo.Probe(&State->Board,FindPos,Reconstruction,pv)) {
+      if (SearchPos(&State->Board,&FindPos,pv))
+         Reconstruction = RECONSTRUCT_FOUND;
+      else {
+         // More than two plies since the last frame that was read; not worth
+         // searching for before the squares settle, as Tick waits for that
+         if (!Settled) {
+            Reconstruction = RECONSTRUCT_NONE;
+            return false;
+         }
+         Reconstruction = Reconstructor.Search(&State->Board,FindPos,reconstruct_max_plies,
+                                               reconstruct_node_budget,pv);
+         if (IsDebug && Reconstruction != RECONSTRUCT_NONE) {
+            char s[100];
+            sprintf(s,"reconstruction %i, %i nodes",Reconstruction,Reconstructor.Nodes);
+            Debug.SaveString(s);
+         }
       }
+      Memo.Store(&State->Board,FindPos,Reconstruction,pv);
+   }
+   if (Reconstruction != RECONSTRUCT_FOUND)
+      return false;
+   int pv_len = 0;
+   while (pv[pv_len])
+     pv_len++;
+   // All but the last move are committed; the last stays the last move
+   for (int i=0; i<pv_len-1; i++) {
       undo_t undo;
-      switch (pv_len) {
-         case 0:
-            State->LastMove = 0;
-            return true;
-         case 1:
-            State->LastMove = pv[0];
-            return true;
-         case 2:
-            move_do(&State->Board,pv[0],&undo);
-            State->MoveHistory[State->MoveHistoryLen] = pv[0];
-            State->MoveHistoryLen++;
-            State->LastMove = pv[1];
-            return true;
-      }
+      move_do(&State->Board,pv[i],&undo);
+      State->MoveHistory[State->MoveHistoryLen] = pv[i];
+      State->MoveHistoryLen++;
+   }
+   State->LastMove = pv_len ? pv[pv_len-1] : 0;
+   return true;
+}
+
+// new_state is a game seen for the first time
+void TEngine::StartGame(TState * new_state)
+{
+  new_state->Inited = true;
+  PositionRecognized = true;
+  InitTimers();
+  AutoPlay = false;
+  AutoPlayWhite = false;
+  AutoPlayBlack = false;
+  StartNewGameEvent = true;
+  move_locked = 0;
+  // The memo's outcomes were found with the last game's readings
+  Memo.Clear();
+  if (IsDebug)
+    Debug.OpenNewFile();
+}
+
+// Nothing was followed yet and the screen shows no new game: the game
+// is joined where it stands, when the frame tells one position (and one
+// way round of the board) apart from all others
+bool TEngine::JoinPosition(TState * State)
+{
+  // Without a highlight, the side to move is the one that didn't make the
+  // last change seen between settled frames: the side whose pieces came
+  // onto new squares moved
+  TFindPos read = BoardRecognize.FindPos;
+  if (!read.IsEqual(&JoinFindPos)) {
+    bool white = read.PieceMoved(White,&JoinFindPos);
+    bool black = read.PieceMoved(Black,&JoinFindPos);
+    JoinTurn = white != black ? (white ? Black : White) : ColourNone;
+    JoinFindPos = read;
+  }
+  int orientation = BoardRecognize.Orientation;
+  board_t board;
+  int found = 0;
+  bool reversed = Reversed;
+  for (int i=0; i<2; i++) {
+    bool candidate = i == 0;
+    if (orientation != orientation_unknown && candidate != (orientation == orientation_white_below))
+      continue;
+    board_t synthesized;
+    ReconstructResult result = SynthesizePosition(BoardRecognize.FindPos,BoardRecognize.Pieces,
+                                                  BoardRecognize.Highlighted,candidate,JoinTurn,
+                                                  &synthesized);
+    if (IsDebug && result != RECONSTRUCT_NONE) {
+      char s[100];
+      sprintf(s,"join reversed %i: %i",candidate,result);
+      Debug.SaveString(s);
+    }
+    if (result == RECONSTRUCT_AMBIGUOUS || result == RECONSTRUCT_FOUND && found)
+      return false;
+    if (result == RECONSTRUCT_FOUND) {
+      board = synthesized;
+      reversed = candidate;
+      found++;
+    }
+  }
+  if (!found)
+    return false;
+  if (reversed != Reversed) {
+    Reversed = reversed;
+    FindPos.Reverse();
+  }
+  State->SetPosition(&board);
+  return true;
+}
+
+// A new game was just recognized, so every square on screen is known:
+// the start position plus the moves found since. The recognizer learns
+// its piece templates from it unless they already read it correctly. A
+// joined game is never learned from: its unknown squares were guessed.
+void TEngine::LearnPieceTemplates(TState * State)
+{
+  board_t board = State->Board;
+  if (State->LastMove) {
+    undo_t undo;
+    move_do(&board,State->LastMove,&undo);
+  }
+  if (BoardRecognize.Pieces.complete && BoardRecognize.Pieces.Matches(&board,Reversed))
+    return;
+  BoardPieces known;
+  known.FromBoard(&board,Reversed);
+  // The squares of the last move may still be tinted by the site's
+  // highlight, which the recognizer only knows once it learned it
+  mv_t last = State->GetLastMove();
+  if (last) {
+    known.square[BoardPieces::ScreenSquare(MOVE_FROM(last),Reversed)] = PieceUnknown12;
+    known.square[BoardPieces::ScreenSquare(MOVE_TO(last),Reversed)] = PieceUnknown12;
+    known.UpdateComplete();
+  }
+  BoardRecognize.LearnPieceTemplates(known);
+}
+
+// With every piece identified the position on screen is known exactly;
+// the up to two moves leading to it start on squares whose contents
+// changed, so only those are tried instead of searching
+bool TEngine::GetNewStateFromPieces(TState * State)
+{
+   const BoardPieces &pieces = BoardRecognize.Pieces;
+   if (!pieces.complete)
+     return false;
+   board_t *board = &State->Board;
+   if (pieces.Matches(board,Reversed)) {
+     State->LastMove = 0;
+     return true;
+   }
+   bool changed[SquareNb];
+   memset(changed,0,sizeof(changed));
+   for (int i=0; i<64; i++) {
+     int sq = BoardPieces::BoardSquare(i,Reversed);
+     int piece = pieces.square[i] == PieceNone12 ? Empty : PieceFrom12[pieces.square[i]];
+     changed[sq] = board->square[sq] != piece;
+   }
+   list_t list;
+   gen_legal_moves(&list,board);
+   for (int i=0; i<LIST_SIZE(&list); i++) {
+     mv_t move = LIST_MOVE(&list,i);
+     if (!changed[MOVE_FROM(move)])
+       continue;
+     undo_t undo;
+     move_do(board,move,&undo);
+     if (pieces.Matches(board,Reversed)) {
+       move_undo(board,move,&undo);
+       State->LastMove = move;
+       return true;
+     }
+     list_t list2;
+     gen_legal_moves(&list2,board);
+     for (int j=0; j<LIST_SIZE(&list2); j++) {
+       mv_t move2 = LIST_MOVE(&list2,j);
+       if (!changed[MOVE_FROM(move2)])
+         continue;
+       undo_t undo2;
+       move_do(board,move2,&undo2);
+       bool match = pieces.Matches(board,Reversed);
+       move_undo(board,move2,&undo2);
+       if (match) {
+         // Like GetNewState: the first move is committed, the second
+         // stays the last move
+         State->MoveHistory[State->MoveHistoryLen] = move;
+         State->MoveHistoryLen++;
+         State->LastMove = move2;
+         return true;
+       }
+     }
+     move_undo(board,move,&undo);
    }
    return false;
 }
@@ -293,16 +475,8 @@ mv_t TEngine::TreatThinkResult()
 
 bool TEngine::Eval(board_t * Board, TFindPos * fp)
 {
-  const sq_t * ptr;
-  int from;
-  TFindPos fp_board;
-  for (int colour = 0; colour < ColourNb; colour++) {
-    for (ptr = &Board->piece[colour][0]; (from=*ptr) != SquareNone; ptr++)
-      fp_board.SetBit(colour,SquareTo_64(from));
-    for (ptr = &Board->pawn[colour][0]; (from=*ptr) != SquareNone; ptr++)
-      fp_board.SetBit(colour,SquareTo_64(from));
-  }
-  return !memcmp(fp,&fp_board,sizeof(TFindPos));
+  // move_do keeps the occupancy in the numbering of TFindPos
+  return Board->occupancy[White] == fp->find_pos[White] && Board->occupancy[Black] == fp->find_pos[Black];
 }
 
 
@@ -314,32 +488,61 @@ bool TEngine::SearchPos(board_t * Board, TFindPos * fp, mv_t pv[])
   }
   list_t list;
   gen_legal_moves(&list,Board);
-  for (int i=0; i<LIST_SIZE(&list); i++) {
-    undo_t undo;
-    mv_t move = LIST_MOVE(&list,i);
-    move_do(Board,move,&undo);
-    bool eval = Eval(Board,fp);
-    move_undo(Board,move,&undo);
-    if (eval) {
+  int squares[2];
+  if (HighlightedSquares(squares) && SearchHighlighted(Board,fp,&list,squares,pv))
+    return true;
+  return ReconstructMoves(Board,*fp,&list,pv);
+}
+
+// The site marks the last move on screen: its two squares, when the
+// recognizer sees exactly two
+bool TEngine::HighlightedSquares(int squares[2])
+{
+  uint64 marked = BoardRecognize.Highlighted;
+  int count = 0;
+  for (int i=0; i<64 && count<=2; i++)
+    if (marked & (((uint64)1)<<i)) {
+      if (count < 2)
+        squares[count] = BoardPieces::BoardSquare(i,Reversed);
+      count++;
+    }
+  return count == 2;
+}
+
+static bool MoveJoins(mv_t move, const int squares[2])
+{
+  int from = MOVE_FROM(move), to = MOVE_TO(move);
+  return from == squares[0] && to == squares[1] || from == squares[1] && to == squares[0];
+}
+
+// SearchPos for the common case that the last move on screen is the
+// highlighted one: it alone, or any move followed by it. Only branches
+// where the side to move then owns a highlighted square get their moves
+// generated, so most of the second ply is never expanded.
+bool TEngine::SearchHighlighted(board_t * Board, TFindPos * fp, list_t * list, const int squares[2], mv_t pv[])
+{
+  for (int i=0; i<LIST_SIZE(list); i++) {
+    mv_t move = LIST_MOVE(list,i);
+    if (MoveJoins(move,squares) && MoveReaches(Board,move,*fp)) {
       pv[0] = move;
       pv[1] = 0;
       return true;
     }
   }
-  //if (!AutoPlayWhite && !AutoPlayBlack)
-    for (int i=0; i<LIST_SIZE(&list); i++) {
-      undo_t undo;
-      mv_t move = LIST_MOVE(&list,i);
-      move_do(Board,move,&undo);
+  // The first of two moves leaves a square its side no longer holds
+  uint64 vacated = Board->occupancy[Board->turn] & ~fp->find_pos[Board->turn];
+  for (int i=0; i<LIST_SIZE(list); i++) {
+    mv_t move = LIST_MOVE(list,i);
+    if (!(vacated & SQUARE_OCCUPANCY(MOVE_FROM(move))))
+      continue;
+    undo_t undo;
+    move_do(Board,move,&undo);
+    if (COLOUR_IS(Board->square[squares[0]],Board->turn) || COLOUR_IS(Board->square[squares[1]],Board->turn)) {
       list_t list2;
       gen_legal_moves(&list2,Board);
       for (int j=0; j<LIST_SIZE(&list2); j++) {
-        undo_t undo2;
         mv_t move2 = LIST_MOVE(&list2,j);
-        move_do(Board,move2,&undo2);
-        bool eval = Eval(Board,fp);
-        move_undo(Board,move2,&undo2);
-        if (eval) {
+        if (MoveJoins(move2,squares) && MoveReaches(Board,move2,*fp)) {
           pv[0] = move;
           pv[1] = move2;
           pv[2] = 0;
@@ -347,11 +550,23 @@ bool TEngine::SearchPos(board_t * Board, TFindPos * fp, mv_t pv[])
           return true;
         }
       }
-      move_undo(Board,move,&undo);
     }
+    move_undo(Board,move,&undo);
+  }
   return false;
 }
 
+// A move was just recognized, so the squares it joins are the ones a
+// site highlights: the recognizer learns the theme's tint from them
+void TEngine::LearnHighlight(const TState * State)
+{
+  mv_t move = State->LastMove;
+  if (!move)
+    return;
+  BoardRecognize.LearnHighlight(BoardPieces::ScreenSquare(MOVE_FROM(move),Reversed),
+                                BoardPieces::ScreenSquare(MOVE_TO(move),Reversed));
+}
+
 void TEngine::ShowPosition()
 {
   // No GUI - this function would display the board in a debug window
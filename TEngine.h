@@ -7,7 +7,9 @@
 #include "move.h"
 #include "board.h"
 #include "move_do.h"
+#include "list.h"
 #include "find_pos.h"
+#include "MoveReconstruct.h"
 #include "TBoardRecognize.h"
 #include "TUCIInterface.h"
 #include "TState.h"
@@ -45,14 +47,32 @@ class TEngine {
     bool StartNewGameEvent;
     bool SwitchOfEngineWhenOpponentMove;
     int MoveLimit;
+    // How the last search for the moves to the position on screen ended
+    ReconstructResult Reconstruction;
   private:
     bool Eval(board_t * Board, TFindPos * fp);
     bool SearchPos(board_t * Board, TFindPos * fp, mv_t pv[]);
+    bool HighlightedSquares(int squares[2]);
+    bool SearchHighlighted(board_t * Board, TFindPos * fp, list_t * list, const int squares[2], mv_t pv[]);
+    void LearnHighlight(const TState * State);
     bool GetNewState(TState * State);
+    bool GetNewStateFromPieces(TState * State);
+    bool JoinPosition(TState * State);
+    void StartGame(TState * new_state);
+    void LearnPieceTemplates(TState * State);
     bool ExtractNewState(TState * new_state);
-    int SquareTo_64(int x);
     board_t StartBoard;
     TFindPos FindPos, LastFindPos;
+    // Readings of the recent frames; a new state is only taken from a
+    // frame whose squares have all settled
+    TObservationFilter Filter;
+    bool Settled;
+    // Last settled reading before a game was joined, and the side to move
+    // its last change showed (ColourNone when it showed none)
+    TFindPos JoinFindPos;
+    int JoinTurn;
+    TLineReconstructor Reconstructor;
+    TReconstructMemo Memo;
 };
 
 #endif
@@ -0,0 +1,76 @@
+//---------------------------------------------------------------------------
+
+#include "TMultiEngine.h"
+#include <windows.h>
+
+TMultiEngine::TMultiEngine(const std::string& FileName)
+   : terminated(false), EngineFileName(FileName)
+{
+}
+
+TMultiEngine::~TMultiEngine()
+{
+   Stop();
+   Clear();
+}
+
+void TMultiEngine::Start()
+{
+   terminated = false;
+   thread = std::thread(&TMultiEngine::Execute, this);
+}
+
+void TMultiEngine::Stop()
+{
+   terminated = true;
+   if (thread.joinable()) {
+      thread.join();
+   }
+}
+
+TBoardRecognize *TMultiEngine::CreateRecognizer(int id)
+{
+  TEngine *engine = new TEngine(EngineFileName);
+  engine->IsDebug = false;
+  engine->Time = 0;
+  engine->TimeSec = 0;
+  engine->IncTime = 0;
+  Engines[id] = engine;
+  return &engine->BoardRecognize;
+}
+
+void TMultiEngine::ReleaseRecognizer(int id, TBoardRecognize *recognize)
+{
+  std::map<int, TEngine*>::iterator it = Engines.find(id);
+  if (it != Engines.end()) {
+    delete it->second;
+    Engines.erase(it);
+  }
+}
+
+TEngine *TMultiEngine::GetEngine(int id)
+{
+  std::map<int, TEngine*>::iterator it = Engines.find(id);
+  return it == Engines.end() ? NULL : it->second;
+}
+
+void TMultiEngine::Tick()
+{
+  if (!Capture())
+    return;
+  for (size_t i=0; i<Boards.size(); i++) {
+    TEngine *engine = GetEngine(Boards[i].Id);
+    engine->TreatThinkResult();
+    engine->Tick();
+  }
+}
+
+//---------------------------------------------------------------------------
+void TMultiEngine::Execute()
+{
+  while (!terminated) {
+    Tick();
+    Sleep(30);
+  }
+}
+//---------------------------------------------------------------------------
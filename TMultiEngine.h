@@ -0,0 +1,36 @@
+//---------------------------------------------------------------------------
+
+#ifndef TMultiEngineH
+#define TMultiEngineH
+//---------------------------------------------------------------------------
+#include <map>
+#include <string>
+#include <thread>
+#include <atomic>
+//---------------------------------------------------------------------------
+#include "MultiBoard.h"
+#include "TEngine.h"
+
+// One TEngine (state tracking plus its own UCI analysis) per board on
+// screen, all fed from a single shared screen capture
+class TMultiEngine : public TMultiBoardCapture
+{
+private:
+   std::thread thread;
+   std::atomic<bool> terminated;
+   std::string EngineFileName;
+   std::map<int, TEngine*> Engines;
+   void Execute();
+protected:
+   TBoardRecognize *CreateRecognizer(int id);
+   void ReleaseRecognizer(int id, TBoardRecognize *recognize);
+public:
+   TMultiEngine(const std::string& FileName);
+   ~TMultiEngine();
+   void Start();
+   void Stop();
+   void Tick();
+   TEngine *GetEngine(int id);
+};
+//---------------------------------------------------------------------------
+#endif
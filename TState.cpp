@@ -17,10 +17,9 @@ TState::~TState()
 
 bool TState::IsWhite()
 {
-  int t = MoveHistoryLen;
-  if (LastMove)
-    t++;
-  return (t%2) == 0;
+  // Board is the position before the last move
+  bool white = Board.turn == White;
+  return LastMove ? !white : white;
 }
 
 void TState::AddMove(mv_t move)
@@ -38,11 +37,20 @@ void TState::SetNewGame()
   MoveHistoryLen = 0;
   board_from_fen(&Board,StartFen);
   LastMove = 0;
+  Fen[0] = 0;
+}
+
+void TState::SetPosition(const board_t *board)
+{
+  MoveHistoryLen = 0;
+  Board = *board;
+  LastMove = 0;
+  board_to_fen(board,Fen,max_fen_len);
 }
 
 bool TState::IsEqual(TState * State)
 {
-  if (Inited != State->Inited)
+  if (Inited != State->Inited || strcmp(Fen,State->Fen) != 0)
     return false;
   int this_moves_len = MoveHistoryLen;
   mv_t this_moves[max_game_len];
@@ -74,6 +82,7 @@ void TState::CopyTo(TState * State)
   for (int i=0; i<MoveHistoryLen; i++)
     State->MoveHistory[i] = MoveHistory[i];
   State->Board = Board;
+  strcpy(State->Fen,Fen);
 }
 
 int TState::Len()
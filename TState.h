@@ -6,6 +6,7 @@
 //---------------------------------------------------------------------------
 
 const int max_game_len = 1000;
+const int max_fen_len = 100;
 
 class TState {
   public:
@@ -17,6 +18,8 @@ class TState {
     bool IsEqual(TState * state);
     void CopyTo(TState * state);
     void SetNewGame();
+    // A game joined in the middle: its moves start from board
+    void SetPosition(const board_t *board);
     void AddMove(mv_t move);
     bool IsWhite();
     bool Inited;
@@ -25,6 +28,8 @@ class TState {
     void CommitLastMove();
     mv_t GetLastMove();
     board_t Board;
+    // Position the moves start from; empty for the start position
+    char Fen[max_fen_len];
 };
 
 #endif
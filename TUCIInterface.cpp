@@ -318,7 +318,12 @@ void TUCIInterface::StartThink(TState * State, int wtime, int btime, int winc, i
 
 void TUCIInterface::MakeGoString(TState * State, std::string& pos)
 {
-   pos = "position startpos";
+   if (State->Fen[0]) {
+     pos = "position fen ";
+     pos += State->Fen;
+   }
+   else
+     pos = "position startpos";
    if (State->MoveHistoryLen > 0 || State->LastMove)
      pos += " moves";
    char move_str[6] = "";
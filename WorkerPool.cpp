@@ -0,0 +1,99 @@
+//---------------------------------------------------------------------------
+#include "WorkerPool.h"
+
+//---------------------------------------------------------------------------
+
+const int worker_pool_max = 7;   // Workers of the shared pool at most
+
+// Set on pool workers, and on a caller while its job runs
+static thread_local bool InPoolJob = false;
+
+TWorkerPool::TWorkerPool(int workers)
+  : Task(NULL), Count(0), Next(0), Busy(0), Generation(0), Stopping(false)
+{
+  for (int i=0; i<workers; i++)
+    Threads.push_back(std::thread(&TWorkerPool::Execute, this));
+}
+
+TWorkerPool::~TWorkerPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(Lock);
+    Stopping = true;
+  }
+  Wake.notify_all();
+  for (size_t i=0; i<Threads.size(); i++)
+    Threads[i].join();
+}
+
+static int SharedWorkers()
+{
+  int workers = (int)std::thread::hardware_concurrency() - 1;
+  if (workers < 0)
+    workers = 0;
+  return workers > worker_pool_max ? worker_pool_max : workers;
+}
+
+TWorkerPool &TWorkerPool::Shared()
+{
+  static TWorkerPool pool(SharedWorkers());
+  return pool;
+}
+
+void TWorkerPool::Work(const std::function<void(int)> &task, int count)
+{
+  for (;;) {
+    int i = Next.fetch_add(1);
+    if (i >= count)
+      return;
+    task(i);
+  }
+}
+
+void TWorkerPool::Run(int count, const std::function<void(int)> &task)
+{
+  if (count <= 0)
+    return;
+  std::unique_lock<std::mutex> job(JobLock, std::defer_lock);
+  if (Threads.empty() || count == 1 || InPoolJob || !job.try_lock()) {
+    for (int i=0; i<count; i++)
+      task(i);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(Lock);
+    Task = &task;
+    Count = count;
+    Next = 0;
+    Busy = (int)Threads.size();
+    Generation++;
+  }
+  Wake.notify_all();
+  InPoolJob = true;
+  Work(task, count);
+  InPoolJob = false;
+  // The job's state lives until every worker has let go of it
+  std::unique_lock<std::mutex> lock(Lock);
+  Done.wait(lock, [this] { return Busy == 0; });
+  Task = NULL;
+}
+
+void TWorkerPool::Execute()
+{
+  InPoolJob = true;
+  unsigned int seen = 0;
+  std::unique_lock<std::mutex> lock(Lock);
+  for (;;) {
+    Wake.wait(lock, [&] { return Stopping || Generation != seen; });
+    if (Stopping)
+      return;
+    seen = Generation;
+    const std::function<void(int)> *task = Task;
+    int count = Count;
+    lock.unlock();
+    Work(*task, count);
+    lock.lock();
+    if (--Busy == 0)
+      Done.notify_one();
+  }
+}
@@ -0,0 +1,46 @@
+//---------------------------------------------------------------------------
+
+#ifndef WorkerPoolH
+#define WorkerPoolH
+//---------------------------------------------------------------------------
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+//---------------------------------------------------------------------------
+// Small pool of persistent worker threads for data-parallel loops. Run
+// hands out the indices of one job to the workers and the calling thread
+// alike and returns when all are done; nothing is created per call.
+// A job that arrives while another runs, or from inside a job (a board
+// per worker whose squares would go to the pool again), runs on the
+// calling thread instead, so jobs can always nest without deadlock.
+//---------------------------------------------------------------------------
+
+class TWorkerPool {
+  public:
+    explicit TWorkerPool(int workers);
+    ~TWorkerPool();
+    int Workers() const { return (int)Threads.size(); }
+    // task(i) for every 0 <= i < count, in any order and on any thread
+    void Run(int count, const std::function<void(int)> &task);
+    // Process-wide pool, one worker less than the hardware has threads
+    static TWorkerPool &Shared();
+  private:
+    std::vector<std::thread> Threads;
+    std::mutex Lock;
+    std::condition_variable Wake;
+    std::condition_variable Done;
+    std::mutex JobLock;                 // Held by the thread whose job runs
+    const std::function<void(int)> *Task;
+    int Count;
+    std::atomic<int> Next;
+    int Busy;                           // Workers still inside the job
+    unsigned int Generation;            // Bumped for every job
+    bool Stopping;
+    void Execute();
+    void Work(const std::function<void(int)> &task, int count);
+};
+
+#endif
@@ -37,10 +37,13 @@ bool TFindPos::GetBit(int colour, int cnt)
 
 uint64 TFindPos::ReverseUINT64(uint64 r)
 {
-  uint64 res = 0;
-  for (int i=0; i<64; i++)
-    res |= ((r>>(63-i))&1)<<i;
-  return res;
+  // Swap ever larger halves: bits, pairs, nibbles, then the bytes
+  r = ((r>>1) & U64(0x5555555555555555)) | ((r & U64(0x5555555555555555))<<1);
+  r = ((r>>2) & U64(0x3333333333333333)) | ((r & U64(0x3333333333333333))<<2);
+  r = ((r>>4) & U64(0x0F0F0F0F0F0F0F0F)) | ((r & U64(0x0F0F0F0F0F0F0F0F))<<4);
+  r = ((r>>8) & U64(0x00FF00FF00FF00FF)) | ((r & U64(0x00FF00FF00FF00FF))<<8);
+  r = ((r>>16) & U64(0x0000FFFF0000FFFF)) | ((r & U64(0x0000FFFF0000FFFF))<<16);
+  return (r>>32) | (r<<32);
 }
 
 void TFindPos::SaveToString(char *s)
@@ -19,7 +19,7 @@ class TFindPos {
     uint64 find_pos[ColourNb];
     bool PieceMoved(int colour, TFindPos * NewFindPos);
   private:
-    uint64 ReverseUINT64(uint64 r);
+    static uint64 ReverseUINT64(uint64 r);
 };
 
 #endif
@@ -78,6 +78,12 @@ bool board_is_ok(const board_t * board) {
             }
          }
 
+         // occupancy
+
+         for (colour = 0; colour < ColourNb; colour++) {
+            if (((board->occupancy[colour] & SQUARE_OCCUPANCY(sq)) != 0) != COLOUR_IS(piece,colour)) return false;
+         }
+
       } else {
 
          // edge square
@@ -166,6 +172,8 @@ bool board_is_ok(const board_t * board) {
    if (board->opening != board_opening(board)) return false;
    if (board->endgame != board_endgame(board)) return false;
 
+   if (board->key != hash_key(board)) return false;
+
    return true;
 }
 
@@ -230,6 +238,9 @@ void board_init_list(board_t * board) {
    board->piece_nb = 0;
    for (piece = 0; piece < 12; piece++) board->number[piece] = 0;
 
+   board->occupancy[White] = 0;
+   board->occupancy[Black] = 0;
+
    // piece lists
 
    for (colour = 0; colour < ColourNb; colour++) {
@@ -255,6 +266,7 @@ void board_init_list(board_t * board) {
 
             board->piece_nb++;
             board->number[PIECE_TO_12(piece)]++;
+            board->occupancy[colour] |= SQUARE_OCCUPANCY(sq);
          }
       }
 
@@ -330,6 +342,7 @@ void board_init_list(board_t * board) {
             board->piece_nb++;
             board->number[PIECE_TO_12(piece)]++;
             board->pawn_file[colour][SQUARE_FILE(sq)] |= BIT(PAWN_RANK(sq,colour));
+            board->occupancy[colour] |= SQUARE_OCCUPANCY(sq);
          }
       }
 
@@ -352,6 +365,7 @@ void board_init_list(board_t * board) {
    // hash key
 
    board->sp = board->ply_nb;
+   board->key = hash_key(board);
 
 
    // legality
@@ -42,6 +42,10 @@ const int StackSize = 4096;
 
 #define KING_POS(board,colour) ((board)->piece[colour][0])
 
+// occupancy bit of a square, numbered rank*8 + 7-file as in TFindPos
+
+#define SQUARE_OCCUPANCY(square) (U64(1) << (SQUARE_TO_64(square)^7))
+
 // types
 
 struct board_t {
@@ -60,12 +64,16 @@ struct board_t {
 
    int pawn_file[ColourNb][FileNb];
 
+   uint64 occupancy[ColourNb]; // squares of each colour, see SQUARE_OCCUPANCY()
+
    int turn;
    int flags;
    int ep_square;
    int ply_nb;
    int sp; // TODO: MOVE ME?
 
+   uint64 key; // Zobrist key, see hash_key()
+
    int cap_sq;
 
    int opening;
@@ -82,6 +82,7 @@ void move_do(board_t * board, int move, undo_t * undo) {
    undo->opening = board->opening;
    undo->endgame = board->endgame;
 
+   undo->key = board->key;
 
    // init
 
@@ -100,6 +101,7 @@ void move_do(board_t * board, int move, undo_t * undo) {
    // update turn
 
    board->turn = opp;
+   board->key ^= RANDOM_64(RandomTurn);
 
    // update castling rights
 
@@ -107,10 +109,12 @@ void move_do(board_t * board, int move, undo_t * undo) {
    new_flags = old_flags & CastleMask[from] & CastleMask[to];
 
    board->flags = new_flags;
+   board->key ^= Castle64[new_flags^old_flags]; // HACK
 
    // update en-passant square
 
    if ((sq=board->ep_square) != SquareNone) {
+      board->key ^= RANDOM_64(RandomEnPassant+SQUARE_FILE(sq)-FileA);
       board->ep_square = SquareNone;
    }
 
@@ -122,6 +126,7 @@ void move_do(board_t * board, int move, undo_t * undo) {
          pawn = PAWN_MAKE(opp);
          if (board->square[to-1] == pawn || board->square[to+1] == pawn) {
             board->ep_square = (from + to) / 2;
+            board->key ^= RANDOM_64(RandomEnPassant+SQUARE_FILE(to)-FileA);
          }
       }
    }
@@ -293,6 +298,7 @@ void move_undo(board_t * board, int move, const undo_t * undo) {
    board->opening = undo->opening;
    board->endgame = undo->endgame;
 
+   board->key = undo->key;
 
    // update key stack
 
@@ -325,6 +331,8 @@ void move_do_null(board_t * board, undo_t * undo) {
    undo->ply_nb = board->ply_nb;
    undo->cap_sq = board->cap_sq;
 
+   undo->key = board->key;
+
    // update key stack
 
    ASSERT(board->sp<StackSize);
@@ -332,11 +340,13 @@ void move_do_null(board_t * board, undo_t * undo) {
    // update turn
 
    board->turn = COLOUR_OPP(board->turn);
+   board->key ^= RANDOM_64(RandomTurn);
 
    // update en-passant square
 
    sq = board->ep_square;
    if (sq != SquareNone) {
+      board->key ^= RANDOM_64(RandomEnPassant+SQUARE_FILE(sq)-FileA);
       board->ep_square = SquareNone;
    }
 
@@ -370,6 +380,8 @@ void move_undo_null(board_t * board, const undo_t * undo) {
    board->ply_nb = undo->ply_nb;
    board->cap_sq = undo->cap_sq;
 
+   board->key = undo->key;
+
    // update key stack
 
    ASSERT(board->sp>0);
@@ -408,6 +420,10 @@ static void square_clear(board_t * board, int square, int piece, bool update) {
    ASSERT(board->square[square]==piece);
    board->square[square] = Empty;
 
+   // occupancy
+
+   board->occupancy[colour] &= ~SQUARE_OCCUPANCY(square);
+
    // piece list
 
    if (!PIECE_IS_PAWN(piece)) {
@@ -501,6 +517,7 @@ static void square_clear(board_t * board, int square, int piece, bool update) {
       // hash key
 
       hash_xor = RANDOM_64(RandomPiece+(piece_12^1)*64+sq_64); // HACK: ^1 for PolyGlot book
+      board->key ^= hash_xor;
 
 
       // material key
@@ -534,6 +551,10 @@ static void square_set(board_t * board, int square, int piece, int pos, bool upd
    ASSERT(board->square[square]==Empty);
    board->square[square] = piece;
 
+   // occupancy
+
+   board->occupancy[colour] |= SQUARE_OCCUPANCY(square);
+
    // piece list
 
    if (!PIECE_IS_PAWN(piece)) {
@@ -631,6 +652,7 @@ static void square_set(board_t * board, int square, int piece, int pos, bool upd
       // hash key
 
       hash_xor = RANDOM_64(RandomPiece+(piece_12^1)*64+sq_64); // HACK: ^1 for PolyGlot book
+      board->key ^= hash_xor;
 
 
       // material key
@@ -677,6 +699,10 @@ static void square_move(board_t * board, int from, int to, int piece, bool updat
    ASSERT(board->pos[to]==-1);
    board->pos[to] = pos;
 
+   // occupancy
+
+   board->occupancy[colour] ^= SQUARE_OCCUPANCY(from) | SQUARE_OCCUPANCY(to);
+
    // piece list
 
    if (!PIECE_IS_PAWN(piece)) {
@@ -715,6 +741,7 @@ static void square_move(board_t * board, int from, int to, int piece, bool updat
       piece_index = RandomPiece + (piece_12^1) * 64; // HACK: ^1 for PolyGlot book
 
       hash_xor = RANDOM_64(piece_index+to_64) ^ RANDOM_64(piece_index+from_64);
+      board->key ^= hash_xor;
 
    }
 }
@@ -0,0 +1,671 @@
+//---------------------------------------------------------------------------
+// InternetChessKiller - Behavioural checks
+// Runs the position tracking (occupancy, move reconstruction, joining a
+// game) on known positions, and the recognition kernels against their
+// plain versions, and reports every result that differs from the expected
+// one.
+// Exits non-zero on a failure, so ctest can run it.
+//---------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "attack.h"
+#include "board.h"
+#include "fen.h"
+#include "hash.h"
+#include "list.h"
+#include "move.h"
+#include "move_do.h"
+#include "move_gen.h"
+#include "pawn.h"
+#include "piece.h"
+#include "random.h"
+#include "square.h"
+#include "value.h"
+#include "vector.h"
+#include "my_util.h"
+#include "find_pos.h"
+#include "MoveReconstruct.h"
+#include "PieceTemplates.h"
+#include "PositionSynthesis.h"
+#include "TState.h"
+#include "ColorUtils.h"
+#include "SquareStats.h"
+#include "FrameSource.h"
+#include "FrameRecognize.h"
+#include "SitePolicies.h"
+#include "TBoardRecognize.h"
+
+// Castling both ways for both sides, and captures of every kind
+const char * const CastlingFen = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1";
+// e5xf6 en passant
+const char * const EnPassantFen = "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3";
+// Promotions with and without a capture, for both sides
+const char * const PromotionFen = "n1n5/PPPk4/8/8/8/8/4Kppp/5N1N b - - 0 1";
+
+const char * const CheckFens[] = { StartFen, CastlingFen, EnPassantFen, PromotionFen };
+const int CheckFenNb = sizeof(CheckFens) / sizeof(CheckFens[0]);
+
+int Failures = 0;
+
+void Check(bool ok, const char *what, const char *fen) {
+    if (ok)
+        return;
+    Failures++;
+    printf("FAILED: %s (%s)\n", what, fen);
+}
+
+// board_is_ok is compiled out (fruit's UseSlowDebug), so the incremental
+// occupancy and key are checked against those built from the squares
+bool BoardConsistent(const board_t *board) {
+    board_t fresh = *board;
+    board_init_list(&fresh);
+    return fresh.occupancy[White] == board->occupancy[White]
+        && fresh.occupancy[Black] == board->occupancy[Black]
+        && fresh.key == board->key;
+}
+
+// Whether an undo gave back the position before the move
+bool SamePosition(const board_t *a, const board_t *b) {
+    return memcmp(a->square, b->square, sizeof(a->square)) == 0
+        && a->turn == b->turn && a->flags == b->flags && a->ep_square == b->ep_square
+        && a->occupancy[White] == b->occupancy[White]
+        && a->occupancy[Black] == b->occupancy[Black]
+        && a->key == b->key;
+}
+
+// Every line of depth plies from board: move_do, move_undo and the null
+// move keep the occupancy and the key
+void CheckMoves(board_t *board, int depth, const char *fen) {
+    if (!board_is_check(board)) {
+        board_t before = *board;
+        undo_t undo;
+        move_do_null(board, &undo);
+        Check(BoardConsistent(board), "null move", fen);
+        move_undo_null(board, &undo);
+        Check(SamePosition(board, &before), "null move undone", fen);
+    }
+    if (depth == 0)
+        return;
+    list_t list;
+    gen_legal_moves(&list, board);
+    for (int i = 0; i < LIST_SIZE(&list); i++) {
+        int move = LIST_MOVE(&list, i);
+        board_t before = *board;
+        undo_t undo;
+        move_do(board, move, &undo);
+        Check(BoardConsistent(board), "move_do", fen);
+        CheckMoves(board, depth - 1, fen);
+        move_undo(board, move, &undo);
+        Check(SamePosition(board, &before), "move_undo", fen);
+    }
+}
+
+void CheckOccupancy() {
+    for (int i = 0; i < CheckFenNb; i++) {
+        board_t board;
+        board_from_fen(&board, CheckFens[i]);
+        Check(BoardConsistent(&board), "board_from_fen", CheckFens[i]);
+        CheckMoves(&board, 2, CheckFens[i]);
+    }
+}
+
+// What the recognizer would read off board
+TFindPos Shown(const board_t *board) {
+    TFindPos pos;
+    pos.find_pos[White] = board->occupancy[White];
+    pos.find_pos[Black] = board->occupancy[Black];
+    return pos;
+}
+
+// Whether the moves of line, ended by 0, lead from board to target
+bool LineReaches(board_t board, const mv_t line[], const TFindPos &target) {
+    for (int i = 0; line[i]; i++) {
+        undo_t undo;
+        move_do(&board, line[i], &undo);
+    }
+    return board.occupancy[White] == target.find_pos[White]
+        && board.occupancy[Black] == target.find_pos[Black];
+}
+
+// Every legal move, and every reply to it, is found again from the
+// occupancy it leaves; of the moves only promotions look alike, so a
+// single move must be found with its own squares
+void CheckReconstruction() {
+    int castles = 0, en_passants = 0, promotions = 0;
+    for (int i = 0; i < CheckFenNb; i++) {
+        const char *fen = CheckFens[i];
+        board_t board;
+        board_from_fen(&board, fen);
+        board_t before = board;
+        list_t list;
+        gen_legal_moves(&list, &board);
+        for (int j = 0; j < LIST_SIZE(&list); j++) {
+            int move = LIST_MOVE(&list, j);
+            const char *kind = "move";
+            if (MOVE_IS_CASTLE(move)) {
+                kind = "castling";
+                castles++;
+            } else if (MOVE_IS_EN_PASSANT(move)) {
+                kind = "en passant";
+                en_passants++;
+            } else if (MOVE_IS_PROMOTE(move)) {
+                kind = "promotion";
+                promotions++;
+            }
+            board_t after = board;
+            undo_t undo;
+            move_do(&after, move, &undo);
+            uint64 occupancy[ColourNb];
+            MoveOccupancy(&board, move, occupancy);
+            Check(occupancy[White] == after.occupancy[White] && occupancy[Black] == after.occupancy[Black],
+                  kind, fen);
+
+            mv_t pv[3];
+            bool found = ReconstructMoves(&board, Shown(&after), &list, pv);
+            Check(found && pv[1] == 0 && MOVE_FROM(pv[0]) == MOVE_FROM(move) && MOVE_TO(pv[0]) == MOVE_TO(move),
+                  kind, fen);
+            Check(SamePosition(&board, &before), "board restored", fen);
+
+            list_t replies;
+            gen_legal_moves(&replies, &after);
+            for (int k = 0; k < LIST_SIZE(&replies); k++) {
+                board_t replied = after;
+                move_do(&replied, LIST_MOVE(&replies, k), &undo);
+                TFindPos target = Shown(&replied);
+                found = ReconstructMoves(&board, target, &list, pv);
+                Check(found && LineReaches(board, pv, target), "two plies", fen);
+            }
+        }
+    }
+    Check(castles > 0 && en_passants > 0 && promotions > 0, "every kind of move tried", "");
+}
+
+// board after the moves of line, each a string like "e2e4"
+board_t Played(const char *fen, const char * const line[], int length) {
+    board_t board;
+    board_from_fen(&board, fen);
+    for (int i = 0; i < length; i++) {
+        undo_t undo;
+        move_do(&board, move_from_string(line[i], &board), &undo);
+    }
+    return board;
+}
+
+// Result of a line search from fen to target, which must leave the board
+// as it was
+ReconstructResult SearchLine(const char *fen, const TFindPos &target, int budget, mv_t line[]) {
+    board_t board;
+    board_from_fen(&board, fen);
+    board_t before = board;
+    TLineReconstructor reconstructor;
+    ReconstructResult result = reconstructor.Search(&board, target, reconstruct_max_plies, budget, line);
+    Check(SamePosition(&board, &before), "line search restored the board", fen);
+    return result;
+}
+
+// Lines of several plies: found when they all end in one position,
+// reported rather than guessed when they don't, and cut by the budget
+void CheckLines() {
+    mv_t line[reconstruct_max_plies + 1];
+    static const char * const opening[] = { "e2e4", "c7c5", "g1f3", "d7d6", "d2d4" };
+    board_t end = Played(StartFen, opening, 5);
+    TFindPos target = Shown(&end);
+    board_t start;
+    board_from_fen(&start, StartFen);
+    Check(SearchLine(StartFen, target, reconstruct_node_budget, line) == RECONSTRUCT_FOUND
+          && LineReaches(start, line, target), "five missed plies", StartFen);
+    int length = 0;
+    while (line[length])
+        length++;
+    Check(length == 5, "shortest line", StartFen);
+
+    // The pawn reaching g1 shows the same whatever it promotes to
+    static const char * const promote[] = { "g2g1q" };
+    end = Played(PromotionFen, promote, 1);
+    Check(SearchLine(PromotionFen, Shown(&end), reconstruct_node_budget, line) == RECONSTRUCT_AMBIGUOUS,
+          "promotion ambiguous", PromotionFen);
+
+    Check(SearchLine(StartFen, target, 3, line) == RECONSTRUCT_BUDGET, "node budget", StartFen);
+
+    // White can't have more pieces than it started with
+    target = Shown(&start);
+    target.find_pos[White] |= SQUARE_OCCUPANCY(E4);
+    Check(SearchLine(StartFen, target, reconstruct_node_budget, line) == RECONSTRUCT_NONE,
+          "unreachable occupancy", StartFen);
+}
+
+// An outcome is given back for its own pair only: the same position and
+// both occupancy words
+void CheckMemo() {
+    TReconstructMemo memo;
+    board_t board;
+    board_from_fen(&board, StartFen);
+    static const char * const opening[] = { "e2e4", "e7e5" };
+    board_t end = Played(StartFen, opening, 2);
+    TFindPos target = Shown(&end);
+    mv_t pv[memo_moves + 1] = { 0 };
+    pv[0] = move_from_string("e2e4", &board);
+    pv[1] = move_from_string("e7e5", &end);
+    ReconstructResult result;
+    mv_t stored[memo_moves + 1];
+    Check(!memo.Probe(&board, target, result, stored), "empty memo", StartFen);
+    memo.Store(&board, target, RECONSTRUCT_FOUND, pv);
+    Check(memo.Probe(&board, target, result, stored) && result == RECONSTRUCT_FOUND
+          && stored[0] == pv[0] && stored[1] == pv[1] && stored[2] == 0, "memo hit", StartFen);
+
+    TFindPos other = target;
+    other.find_pos[Black] ^= SQUARE_OCCUPANCY(E5) | SQUARE_OCCUPANCY(E6);
+    Check(!memo.Probe(&board, other, result, stored), "memo occupancy mismatch", StartFen);
+    other = target;
+    other.find_pos[White] ^= SQUARE_OCCUPANCY(E4);
+    Check(!memo.Probe(&board, other, result, stored), "memo occupancy mismatch", StartFen);
+
+    // Both pairs kept side by side, each with its own outcome
+    memo.Store(&board, other, RECONSTRUCT_NONE, pv);
+    Check(memo.Probe(&board, other, result, stored) && result == RECONSTRUCT_NONE && stored[0] == 0,
+          "memo second pair", StartFen);
+    Check(memo.Probe(&board, target, result, stored) && result == RECONSTRUCT_FOUND && stored[0] == pv[0],
+          "memo first pair kept", StartFen);
+
+    // Same squares, other side to move
+    board_t turned = board;
+    undo_t undo;
+    move_do_null(&turned, &undo);
+    Check(!memo.Probe(&turned, target, result, stored), "memo key mismatch", StartFen);
+
+    memo.Clear();
+    Check(!memo.Probe(&board, target, result, stored), "memo cleared", StartFen);
+    // Readings of one board that differ in a single square spread over the
+    // buckets, so none pushes another out
+    list_t list;
+    gen_legal_moves(&list, &board);
+    for (int i = 0; i < 16; i++) {
+        other = target;
+        other.find_pos[White] ^= SQUARE_OCCUPANCY(A3 + (i & 7) + (i >> 3) * 16);
+        pv[0] = LIST_MOVE(&list, i);
+        pv[1] = 0;
+        memo.Store(&board, other, RECONSTRUCT_FOUND, pv);
+    }
+    for (int i = 0; i < 16; i++) {
+        other = target;
+        other.find_pos[White] ^= SQUARE_OCCUPANCY(A3 + (i & 7) + (i >> 3) * 16);
+        Check(memo.Probe(&board, other, result, stored) && stored[0] == LIST_MOVE(&list, i),
+              "memo readings spread", StartFen);
+    }
+}
+
+// What the recognizer would read off board on a screen oriented as
+// reversed is, every piece identified
+void ReadScreen(const board_t *board, bool reversed, TFindPos *pos, BoardPieces *pieces) {
+    *pos = Shown(board);
+    if (reversed)
+        pos->Reverse();
+    pieces->FromBoard(board, reversed);
+}
+
+// Synthesis of the position read; fen gets the FEN a joined game sends
+ReconstructResult Synthesize(const TFindPos &pos, const BoardPieces &pieces, uint64 highlighted,
+                             bool reversed, int turn, char fen[]) {
+    board_t board;
+    ReconstructResult result = SynthesizePosition(pos, pieces, highlighted, reversed, turn, &board);
+    fen[0] = 0;
+    if (result == RECONSTRUCT_FOUND) {
+        TState state;
+        state.SetPosition(&board);
+        strcpy(fen, state.Fen);
+    }
+    return result;
+}
+
+// Joining known positions: the side to move from the highlight or as
+// given, unknown squares filled in by their template scores, castling
+// only from an untouched back rank
+void CheckSynthesis() {
+    char fen[max_fen_len];
+    for (int reversed = 0; reversed < 2; reversed++) {
+        board_t board;
+        board_from_fen(&board, CastlingFen);
+        TFindPos pos;
+        BoardPieces pieces;
+        ReadScreen(&board, reversed != 0, &pos, &pieces);
+        Check(Synthesize(pos, pieces, 0, reversed != 0, White, fen) == RECONSTRUCT_FOUND
+              && strcmp(fen, CastlingFen) == 0, "joined position", CastlingFen);
+        // Both sides could be to move
+        Check(Synthesize(pos, pieces, 0, reversed != 0, ColourNone, fen) == RECONSTRUCT_AMBIGUOUS,
+              "side to move unknown", CastlingFen);
+
+        // The queen and a knight unread: the templates' scores decide,
+        // and without any there is nothing to decide by
+        int queen = BoardPieces::ScreenSquare(E2, reversed != 0);
+        int knight = BoardPieces::ScreenSquare(C3, reversed != 0);
+        pieces.square[queen] = pieces.square[knight] = PieceUnknown12;
+        pieces.UpdateComplete();
+        for (int p = 0; p < 12; p++)
+            pieces.match[queen][p] = pieces.match[knight][p] = 0;
+        Check(Synthesize(pos, pieces, 0, reversed != 0, White, fen) == RECONSTRUCT_AMBIGUOUS,
+              "unknown squares without scores", CastlingFen);
+        for (int p = 0; p < 12; p++) {
+            pieces.match[queen][p] = p == BlackQueen12 ? 0.75f : 0.6f;
+            pieces.match[knight][p] = p == WhiteKnight12 ? 0.7f : 0.55f;
+        }
+        Check(Synthesize(pos, pieces, 0, reversed != 0, White, fen) == RECONSTRUCT_FOUND
+              && strcmp(fen, CastlingFen) == 0, "unknown squares by score", CastlingFen);
+        pieces.match[knight][WhiteBishop12] = 0.69f;
+        Check(Synthesize(pos, pieces, 0, reversed != 0, White, fen) == RECONSTRUCT_AMBIGUOUS,
+              "unknown squares too close", CastlingFen);
+    }
+
+    // The highlighted double step tells the side to move and opens en passant
+    board_t board;
+    board_from_fen(&board, EnPassantFen);
+    TFindPos pos;
+    BoardPieces pieces;
+    ReadScreen(&board, true, &pos, &pieces);
+    uint64 highlighted = U64(1) << BoardPieces::ScreenSquare(F7, true)
+                       | U64(1) << BoardPieces::ScreenSquare(F5, true);
+    Check(Synthesize(pos, pieces, highlighted, true, ColourNone, fen) == RECONSTRUCT_FOUND
+          && strcmp(fen, "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 1") == 0,
+          "highlighted double step", EnPassantFen);
+
+    // A knight on the queen's square: White's back rank was touched
+    const char *moved = "r3k2r/pppppppp/8/8/8/8/PPPPPPPP/R2NK2R w KQkq - 0 1";
+    board_from_fen(&board, moved);
+    ReadScreen(&board, true, &pos, &pieces);
+    Check(Synthesize(pos, pieces, 0, true, White, fen) == RECONSTRUCT_FOUND
+          && strcmp(fen, "r3k2r/pppppppp/8/8/8/8/PPPPPPPP/R2NK2R w kq - 0 1") == 0,
+          "castling from a touched back rank", moved);
+}
+
+// Deterministic pseudo-random numbers, so a failure can be run again
+unsigned int CheckRandom() {
+    static unsigned int seed = 12345;
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 8;
+}
+
+// Every row kernel at every level the CPU has gives what the scalar one
+// gives, on rows of every length up to past two AVX2 blocks and from
+// every start alignment
+void CheckColorKernels() {
+    const int max_count = 80;
+    const int max_offset = 8;
+    ColorKernelLevel best = DetectColorKernelLevel();
+    int pixels[max_count + max_offset], values[max_count + max_offset];
+    int distance[2][max_count];
+    unsigned char brightness[2][max_count], threshold[2][max_count], piece[2][max_count];
+    unsigned char c0[2][max_count], c1[2][max_count], c2[2][max_count];
+    for (int level = KERNELS_SSE2; level <= best; level++) {
+        for (int round = 0; round < 20; round++) {
+            for (int i = 0; i < max_count + max_offset; i++) {
+                // Half of them grey, so PieceMaskRow finds both colours
+                pixels[i] = (int)(CheckRandom() << 8 ^ CheckRandom());
+                if (CheckRandom() & 1)
+                    pixels[i] = (pixels[i] & 0xFF030303) | (int)(CheckRandom() % 64 * 4 * 0x010101u);
+                values[i] = (int)(CheckRandom() % 400000) - 1000;
+            }
+            int target = (int)(CheckRandom() << 8 ^ CheckRandom());
+            int limit = (int)(CheckRandom() % 200000);
+            int white = (int)(CheckRandom() % 256), black = (int)(CheckRandom() % 256);
+            for (int count = 0; count <= max_count; count++) {
+                const int *row = pixels + count % max_offset;
+                const int *vals = values + count % max_offset;
+                for (int k = 0; k < 2; k++) {
+                    SetColorKernelLevel(k == 0 ? KERNELS_SCALAR : (ColorKernelLevel)level);
+                    ColorDistanceRow(row, count, target, distance[k]);
+                    BrightnessRow(row, count, brightness[k]);
+                    ThresholdMaskRow(vals, count, limit, threshold[k]);
+                    PieceMaskRow(row, count, white, black, piece[k]);
+                    UnpackRow(row, count, c0[k], c1[k], c2[k]);
+                }
+                const char *name = level == KERNELS_SSE2 ? "SSE2" : "AVX2";
+                Check(memcmp(distance[0], distance[1], count * sizeof(int)) == 0, "ColorDistanceRow", name);
+                Check(memcmp(brightness[0], brightness[1], count) == 0, "BrightnessRow", name);
+                Check(memcmp(threshold[0], threshold[1], count) == 0, "ThresholdMaskRow", name);
+                Check(memcmp(piece[0], piece[1], count) == 0, "PieceMaskRow", name);
+                Check(memcmp(c0[0], c0[1], count) == 0 && memcmp(c1[0], c1[1], count) == 0
+                      && memcmp(c2[0], c2[1], count) == 0, "UnpackRow", name);
+            }
+        }
+    }
+    if (best == KERNELS_SCALAR)
+        printf("No SIMD kernels on this CPU: only the scalar ones ran\n");
+    SetColorKernelLevel(best);
+}
+
+// Piece mask of a check image: the low two bits of each pixel
+struct MaskBitsPolicy {
+    void PieceRow(const int *pixels, int count, unsigned char *mask) const {
+        for (int i = 0; i < count; i++)
+            mask[i] = (unsigned char)(pixels[i] & (PIECE_MASK_WHITE | PIECE_MASK_BLACK));
+    }
+};
+
+// Whether a w x h block of pixels with bit lies in the rectangle, pixel
+// by pixel, clipped as TSquareStats::HasBlock clips it
+bool HasBlockDirect(const int *square, int stride, int size, int x, int y, int rw, int rh,
+                    int w, int h, int bit) {
+    int x1 = x + rw > size ? size : x + rw;
+    int y1 = y + rh > size ? size : y + rh;
+    if (x < 0)
+        x = 0;
+    if (y < 0)
+        y = 0;
+    if (w <= 0 || h <= 0)
+        return x1 > x && y1 > y;
+    for (int top = y; top + h <= y1; top++)
+        for (int left = x; left + w <= x1; left++) {
+            bool full = true;
+            for (int i = 0; i < h && full; i++)
+                for (int j = 0; j < w && full; j++)
+                    full = (square[(top + i) * stride + left + j] & bit) != 0;
+            if (full)
+                return true;
+        }
+    return false;
+}
+
+// A board of 8 x 8 squares of size pixels, as random white, black and
+// overlapping patches on a random background; one pixel in noise (when
+// not 0) is flipped to another class, so the patches get ragged edges
+void PaintMask(std::vector<int> &image, int size, int noise) {
+    int stride = 8 * size;
+    image.resize(stride * stride);
+    for (size_t i = 0; i < image.size(); i++)
+        image[i] = (int)(CheckRandom() & 0xFFFFFC);
+    for (int patch = 0; patch < 64 * 6; patch++) {
+        int w = 1 + (int)(CheckRandom() % size), h = 1 + (int)(CheckRandom() % size);
+        int x = (int)(CheckRandom() % (stride - w)), y = (int)(CheckRandom() % (stride - h));
+        int bits = 1 + (int)(CheckRandom() % 3);
+        for (int i = y; i < y + h; i++)
+            for (int j = x; j < x + w; j++)
+                image[i * stride + j] = (image[i * stride + j] & ~3) | bits;
+    }
+    if (noise)
+        for (size_t i = 0; i < image.size(); i++)
+            if (CheckRandom() % noise == 0)
+                image[i] = (image[i] & ~3) | (int)(CheckRandom() % 4);
+}
+
+// Rectangle totals and the block search of TSquareStats against direct
+// counts, on masks of random white, black and overlapping patches; the
+// three packed counts must subtract without borrowing from each other
+void CheckSquareStats() {
+    static const int sizes[] = { 12, 37, 300 };
+    for (int n = 0; n < 3; n++) {
+        int size = sizes[n];
+        int stride = 8 * size;
+        std::vector<int> image;
+        PaintMask(image, size, 0);
+        TSquareStats stats;
+        stats.Build(MaskBitsPolicy(), &image[0], stride, size, ~(uint64)0);
+        for (int round = 0; round < 1000; round++) {
+            int sq = (int)(CheckRandom() % 64);
+            const int *square = &image[(sq >> 3) * size * stride + (sq & 7) * size];
+            int x = (int)(CheckRandom() % (size + 4)) - 2, y = (int)(CheckRandom() % (size + 4)) - 2;
+            int rw = (int)(CheckRandom() % (size + 2)), rh = (int)(CheckRandom() % (size + 2));
+
+            SquareStats rect = stats.Rect(sq, x, y, rw, rh);
+            int pixels = 0, white = 0, black = 0, pieces = 0;
+            unsigned int sum0 = 0;
+            for (int i = y < 0 ? 0 : y; i < y + rh && i < size; i++)
+                for (int j = x < 0 ? 0 : x; j < x + rw && j < size; j++) {
+                    int pixel = square[i * stride + j];
+                    pixels++;
+                    white += (pixel & PIECE_MASK_WHITE) != 0;
+                    black += (pixel & PIECE_MASK_BLACK) != 0;
+                    pieces += (pixel & 3) != 0;
+                    sum0 += pixel & 255;
+                }
+            Check(rect.pixels == pixels && rect.white == white && rect.black == black
+                  && rect.pieces == pieces && rect.sum[0] == sum0, "TSquareStats::Rect", "random mask");
+
+            int w = (int)(CheckRandom() % 12), h = (int)(CheckRandom() % 12);
+            for (int bit = 1; bit <= 2; bit++)
+                Check(stats.HasBlock(sq, x, y, rw, rh, w, h, bit == PIECE_MASK_WHITE)
+                      == HasBlockDirect(square, stride, size, x, y, rw, rh, w, h, bit),
+                      "TSquareStats::HasBlock", "random mask");
+        }
+    }
+}
+
+// The row scan TSquareClassifier::FindPieceBlock replaced: a run of
+// more than width pixels with bit, then the same within its span on the
+// next row, depth rows down
+bool NestedRuns(const int *row, int stride, int length, int width, int depth, int bit) {
+    if (depth <= 0)
+        return true;
+    for (int i = 0; i < length; ) {
+        if (!(row[i] & bit)) {
+            i++;
+            continue;
+        }
+        int begin = i;
+        while (i < length && (row[i] & bit))
+            i++;
+        if (i - begin > width && NestedRuns(row + begin + stride, stride, i - begin, width, depth - 1, bit))
+            return true;
+    }
+    return false;
+}
+
+// FindPieceBlock, as a block search over the square statistics, against
+// the nested runs started from each of the first rows, on ragged patches
+void CheckPieceBlocks() {
+    const int size = 40;
+    const int stride = 8 * size;
+    std::vector<int> image;
+    PaintMask(image, size, 20);
+    TSquareStats stats;
+    stats.Build(MaskBitsPolicy(), &image[0], stride, size, ~(uint64)0);
+    for (int round = 0; round < 2000; round++) {
+        int sq = (int)(CheckRandom() % 64);
+        int corner = (int)(CheckRandom() % 4);
+        int real_size = size - 2 * corner;
+        int width = (int)(CheckRandom() % 30) - 1;
+        int depth = (int)(CheckRandom() % 30);
+        int rows = (int)(CheckRandom() % (real_size - depth + 2));
+        const int *start = &image[((sq >> 3) * size + corner) * stride + (sq & 7) * size + corner];
+        for (int bit = 1; bit <= 2; bit++) {
+            bool white = bit == PIECE_MASK_WHITE;
+            // FindPieceBlock's reading of the scan's parameters
+            bool block = rows > 0 && (depth <= 0 ||
+                stats.HasBlock(sq, corner, corner, real_size, rows + depth - 1 > real_size ? real_size : rows + depth - 1,
+                               width < 0 ? 1 : width + 1, depth, white));
+            bool runs = false;
+            for (int j = 0; j < rows && !runs; j++)
+                runs = NestedRuns(start + j * stride, stride, real_size, width, depth, bit);
+            Check(block == runs, "piece block against the row scan", "random mask");
+        }
+    }
+}
+
+// Large squares read from the sample lattice (recognition.samples) give
+// the positions and confidences the pixel by pixel scan gives, on every
+// site's defaults at board sizes from 400 to 1200 pixels
+void CheckLatticeReading() {
+    // The initial position, a middle game and an empty board, top-left
+    // square first, drawn with a glyph per piece type
+    static const char *boards[3] = {
+        "rnbqkbnrpppppppp................................PPPPPPPPRNBQKBNR",
+        "r..q.rk.pp..bppp..n.pn....bpP......P.B....N..N..PP..QPPPR...R.K.",
+        "................................................................",
+    };
+    static const char letters[] = "PpNnBbRrQqKk";
+    for (int site = chessbase; site <= lichess; site++) {
+        // One recognizer per site keeps its colour table for all the boards
+        TBoardRecognize recognize;
+        recognize.ProgramType = site;
+        recognize.BoardCapture.ProgramType = site;
+        recognize.BoardCapture.LoadDetectionConfig();
+        // Squares from 50 pixels up are read on the lattice
+        for (int size = 400; size <= 1200; size += 400) {
+            for (int p = 0; p < 3; p++) {
+                int extent = size + 100;
+                TSyntheticFrameSource canvas(extent, extent);
+                SyntheticBoardStyle style;
+                style.border = recognize.BoardCapture.DetectionConfig.border.color;
+                canvas.Clear(style.background);
+                int pieces[64];
+                for (int i = 0; i < 64; i++)
+                    pieces[i] = boards[p][i] == '.' ? -1 : (int)(strchr(letters, boards[p][i]) - letters);
+                canvas.RenderPosition(50, 50, size, style, pieces);
+                recognize.BoardCapture.SetFrameSource(&canvas);
+                recognize.Recognize();
+                Check(recognize.BoardCapture.Captured, "synthetic board located", "lattice");
+                if (!recognize.BoardCapture.Captured)
+                    continue;
+
+                CapturedFrame frame;
+                canvas.Grab(0, 0, extent, extent, frame);
+                BoardRect rect = recognize.BoardCapture.GetBoardRect();
+                // The colours calibrated on the board, with and without the lattice
+                SiteDetectionConfig lattice = recognize.BoardCapture.DetectionConfig;
+                SiteDetectionConfig dense = lattice;
+                dense.recognition.samples = 0;
+                dense.revision++;
+                BoardObservation sampled = RecognizeFrame(frame.pixels, frame.stride, frame.width, frame.height,
+                                                          rect, site, lattice);
+                BoardObservation scanned = RecognizeFrame(frame.pixels, frame.stride, frame.width, frame.height,
+                                                          rect, site, dense);
+                Check(sampled.recognized && scanned.recognized
+                      && sampled.FindPos.IsEqual(&scanned.FindPos)
+                      && memcmp(sampled.confidence, scanned.confidence, sizeof(sampled.confidence)) == 0,
+                      "lattice against every pixel", "synthetic board");
+            }
+        }
+    }
+}
+
+int main()
+{
+    util_init();
+    my_random_init();
+    square_init();
+    piece_init();
+    pawn_init_bit();
+    value_init();
+    vector_init();
+    attack_init();
+    move_do_init();
+    random_init();
+    hash_init();
+
+    CheckOccupancy();
+    CheckReconstruction();
+    CheckLines();
+    CheckMemo();
+    CheckSynthesis();
+    CheckColorKernels();
+    CheckSquareStats();
+    CheckPieceBlocks();
+    CheckLatticeReading();
+
+    if (Failures) {
+        printf("%d checks failed\n", Failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
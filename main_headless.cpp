@@ -0,0 +1,205 @@
+//---------------------------------------------------------------------------
+// InternetChessKiller - Headless recognition driver
+// Runs capture and board recognition on recorded or synthetic frames,
+// without GDI and without the Sleep-paced TMainThread loop.
+//---------------------------------------------------------------------------
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <cstdio>
+#include <chrono>
+#include "FrameSource.h"
+#include "TBoardRecognize.h"
+#include "MultiBoard.h"
+
+// Occupancy of the initial position, square 0 = top-left (a8 seen by White)
+const uint64 SyntheticBlack = U64(0x000000000000FFFF);
+const uint64 SyntheticWhite = U64(0xFFFF000000000000);
+
+void PrintUsage() {
+    std::cout << "Usage: ick_headless [options] [frame files...]" << std::endl;
+    std::cout << "  -site N        Program type (detection.ini section), default 0" << std::endl;
+    std::cout << "  -seq PATTERN   Add a printf-style numbered frame sequence" << std::endl;
+    std::cout << "  -raw WxH       Size of headerless 32-bit raw frames" << std::endl;
+    std::cout << "  -synthetic     Render an initial position instead of reading files" << std::endl;
+    std::cout << "  -multi         Track every board on screen (synthetic: two boards)" << std::endl;
+    std::cout << "  -repeat N      Recognize every frame N times (benchmark)" << std::endl;
+    std::cout << "  -pure          Locate once, then time RecognizeFrame on the whole frame" << std::endl;
+    std::cout << "  -threads N     Worker threads for squares and boards (0: none)" << std::endl;
+    std::cout << "  -quiet         Print only the summary" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    int programType = 0;
+    int repeat = 1;
+    int threads = -1;
+    bool synthetic = false;
+    bool multi = false;
+    bool pure = false;
+    bool quiet = false;
+    TFileFrameSource files;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-site" && i + 1 < argc) {
+            programType = atoi(argv[++i]);
+        } else if (arg == "-seq" && i + 1 < argc) {
+            files.AddSequence(argv[++i], 0);
+        } else if (arg == "-raw" && i + 1 < argc) {
+            int w = 0, h = 0;
+            if (sscanf(argv[++i], "%dx%d", &w, &h) == 2)
+                files.SetRawSize(w, h);
+        } else if (arg == "-synthetic") {
+            synthetic = true;
+        } else if (arg == "-multi") {
+            multi = true;
+        } else if (arg == "-pure") {
+            pure = true;
+        } else if (arg == "-repeat" && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (arg == "-threads" && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (arg == "-quiet") {
+            quiet = true;
+        } else if (arg[0] == '-') {
+            PrintUsage();
+            return 1;
+        } else {
+            files.AddFile(arg);
+        }
+    }
+    if (!synthetic && files.FrameCount() == 0) {
+        PrintUsage();
+        return 1;
+    }
+
+    // The shared pool unless a thread count was given
+    TWorkerPool ownPool(threads > 0 ? threads : 0);
+    TWorkerPool *pool = threads < 0 ? &TWorkerPool::Shared() : &ownPool;
+
+    TBoardRecognize recognize;
+    recognize.Pool = pool;
+    recognize.ProgramType = programType;
+    recognize.BoardCapture.ProgramType = programType;
+    recognize.BoardCapture.LoadDetectionConfig();
+    TMultiBoardCapture boards;
+    boards.Pool = pool;
+    boards.SetProgramType(programType);
+
+    TSyntheticFrameSource canvas(1280, 1024);
+    TFrameSource *source = &files;
+    if (synthetic) {
+        SyntheticBoardStyle style;
+        canvas.Clear(style.background);
+        if (multi) {
+            canvas.RenderBoard(40, 100, 480, style, SyntheticWhite, SyntheticBlack);
+            canvas.RenderBoard(640, 300, 560, style, SyntheticBlack, SyntheticWhite);
+        } else {
+            canvas.RenderBoard(200, 150, 640, style, SyntheticWhite, SyntheticBlack);
+        }
+        source = &canvas;
+    }
+    recognize.BoardCapture.SetFrameSource(source);
+    boards.SetFrameSource(source);
+
+    int frames = 0;
+    int captured = 0;
+    unsigned int transit = 0;
+    char s[1000];
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    do {
+        if (!synthetic && !files.NextFrame())
+            break;
+        if (multi) {
+            for (int r = 0; r < repeat; r++) {
+                boards.Capture();
+                boards.Recognize();
+                frames++;
+                for (size_t b = 0; b < boards.Boards.size(); b++) {
+                    if (boards.Boards[b].Recognize->BoardCapture.Captured)
+                        captured++;
+                    if (boards.Boards[b].Recognize->InTransit)
+                        transit++;
+                }
+            }
+            if (!quiet) {
+                std::cout << "frame " << (synthetic ? 0 : files.CurrentFrame)
+                          << ": " << boards.Boards.size() << " boards" << std::endl;
+                for (size_t b = 0; b < boards.Boards.size(); b++) {
+                    TTrackedBoard &board = boards.Boards[b];
+                    std::cout << "board #" << board.Id << " at " << board.Rect.x << "," << board.Rect.y
+                              << " " << board.Rect.size << "px";
+                    if (board.Recognize->BoardCapture.Captured) {
+                        board.Recognize->FindPos.SaveToString(s);
+                        std::cout << std::endl << s << std::endl;
+                    } else {
+                        std::cout << " lost" << std::endl;
+                    }
+                }
+            }
+            continue;
+        }
+        if (pure) {
+            // The capture only finds the board; recognition then sees
+            // nothing but the frame, its rect and the config
+            recognize.Recognize();
+            BoardObservation observation;
+            CapturedFrame frame;
+            int width = 0, height = 0;
+            if (recognize.BoardCapture.Captured && source->GetScreenSize(width, height) &&
+                source->Grab(0, 0, width, height, frame)) {
+                BoardRect rect = recognize.BoardCapture.GetBoardRect();
+                for (int r = 0; r < repeat; r++) {
+                    observation = RecognizeFrame(frame.pixels, frame.stride, frame.width, frame.height, rect,
+                                                 programType, recognize.BoardCapture.DetectionConfig, pool);
+                    frames++;
+                    if (observation.recognized)
+                        captured++;
+                }
+            }
+            if (!quiet) {
+                std::cout << "frame " << (synthetic ? 0 : files.CurrentFrame);
+                if (observation.recognized) {
+                    observation.FindPos.SaveToString(s);
+                    std::cout << " board " << observation.squareSize*8 << "px" << std::endl << s << std::endl;
+                } else {
+                    std::cout << " no board" << std::endl;
+                }
+            }
+            continue;
+        }
+        for (int r = 0; r < repeat; r++) {
+            recognize.Recognize();
+            frames++;
+            if (recognize.BoardCapture.Captured)
+                captured++;
+            if (recognize.InTransit)
+                transit++;
+        }
+        if (!quiet) {
+            std::cout << "frame " << (synthetic ? 0 : files.CurrentFrame)
+                      << " t=" << recognize.BoardCapture.FrameTime << "ms";
+            if (recognize.InTransit) {
+                std::cout << " in transit, dropped" << std::endl;
+            } else if (recognize.BoardCapture.Captured) {
+                recognize.FindPos.SaveToString(s);
+                std::cout << " board " << recognize.BoardCapture.BoardSize << "px" << std::endl << s << std::endl;
+            } else {
+                std::cout << " no board" << std::endl;
+            }
+        }
+    } while (!synthetic);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << frames << " recognitions, " << captured << " with board, ";
+    if (transit)
+        std::cout << transit << " in transit, ";
+    std::cout << elapsed * 1000.0 << " ms";
+    if (elapsed > 0)
+        std::cout << " (" << frames / elapsed << " frames/s)";
+    std::cout << std::endl;
+    return 0;
+}
+//---------------------------------------------------------------------------
@@ -6,12 +6,15 @@
 #include <windows.h>
 #include <iostream>
 #include <string>
+#include <cstring>
 #include "TEngine.h"
 #include "TMainThreadObject.h"
+#include "TMultiEngine.h"
 
 // Global variables
 TEngine* g_Engine = nullptr;
 TMainThread* g_MainThread = nullptr;
+TMultiEngine* g_MultiEngine = nullptr;
 bool g_Running = true;
 
 // Default configuration
@@ -27,7 +30,7 @@ void LogMessage(const char* message) {
 
 //---------------------------------------------------------------------------
 // Initialize the engine and detection system
-bool InitializeEngine() {
+bool InitializeEngine(bool multiBoard) {
     try {
         LogMessage("Initializing InternetChessKiller...");
         
@@ -63,6 +66,18 @@ bool InitializeEngine() {
         
         LogMessage(("Using engine: " + enginePath).c_str());
         
+        if (multiBoard) {
+            // One analysis engine per board found on screen
+            g_MultiEngine = new TMultiEngine(enginePath);
+            g_MultiEngine->SetProgramType(DEFAULT_PROGRAM_TYPE);
+            g_MultiEngine->Start();
+            
+            LogMessage("Multi-board analysis started");
+            LogMessage("Every board on screen gets its own engine.");
+            LogMessage("Press ESC to exit...");
+            return true;
+        }
+        
         // Create engine instance
         g_Engine = new TEngine(enginePath);
         g_Engine->BoardRecognize.ProgramType = DEFAULT_PROGRAM_TYPE;
@@ -105,6 +120,12 @@ bool InitializeEngine() {
 void Shutdown() {
     LogMessage("Shutting down...");
     
+    if (g_MultiEngine) {
+        g_MultiEngine->Stop();
+        delete g_MultiEngine;
+        g_MultiEngine = nullptr;
+    }
+    
     if (g_MainThread) {
         g_MainThread->Stop();
         delete g_MainThread;
@@ -156,7 +177,8 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
     int result = 0;
     
     try {
-        if (!InitializeEngine()) {
+        bool multiBoard = lpCmdLine && strstr(lpCmdLine, "-multi") != NULL;
+        if (!InitializeEngine(multiBoard)) {
             std::cerr << "Failed to initialize engine" << std::endl;
             result = 1;
         } else {